@@ -0,0 +1,188 @@
+// Address-space identifiers.
+//
+// Each user address space (a thread group's page table) runs with
+// an ASID in satp, so its TLB entries survive switches to the
+// kernel and to other processes, and the trampoline need not flush
+// the TLB on every trap. ASIDs come in pairs: an even one for the
+// user page table, and the next odd one for the group's kernel
+// page table (see kvmcreate() in vm.c), which maps the same user
+// memory. ASID 0 belongs to the global kernel page table.
+//
+// ASIDs are handed out in generations. An address space keeps its
+// ASID until the hardware's supply runs out; then a new generation
+// starts, every address space takes a fresh ASID the next time it
+// runs, and each hart flushes its whole TLB before it uses an ASID
+// from the new generation.
+//
+// Unmapping user pages leaves stale entries tagged with the
+// address space's ASID. asidflush() removes them from this hart's
+// TLB at once, and marks the other harts that have run the address
+// space so that they flush it before they next return to it. A
+// thread still running the address space on another hart meanwhile
+// could reach freed pages, so code that frees pages of a group
+// that may have other threads stops them first; see tgstop().
+//
+// If the hardware implements too few ASID bits, every page table
+// runs with ASID 0, which tells the trampoline to flush on every
+// switch, and asidswitch() flushes too.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+#define ASIDBITS 16
+#define ASIDMASK ((1L << ASIDBITS) - 1)
+
+struct {
+  struct spinlock lock;
+  uint64 gen;     // current generation, starting at 1
+  uint64 next;    // next free (even) ASID in this generation
+  uint64 max;     // largest ASID the hardware supports; 0 if none
+} asids;
+
+extern pagetable_t kernel_pagetable;  // vm.c
+
+// Find out how many ASID bits satp implements, by writing
+// all ones to the field and reading back what stuck.
+// Called on hart 0 with paging on.
+void
+asidinit(void)
+{
+  uint64 satp = r_satp();
+
+  initlock(&asids.lock, "asid");
+  w_satp(satp | SATP_ASID(ASIDMASK));
+  asids.max = (r_satp() >> 44) & ASIDMASK;
+  w_satp(satp);
+  sfence_vma();
+  if(asids.max < 3)
+    asids.max = 0;   // not even one pair
+  asids.gen = 1;
+  asids.next = 2;
+}
+
+// Give tg's address space a fresh ASID the next time it runs,
+// e.g. because exec() replaced its page table.
+// The old ASID is not reused before the next generation.
+void
+asidnew(struct tgroup *tg)
+{
+  tg->asid = 0;
+  tg->cpus = 0;
+  tg->stale = 0;
+}
+
+// Return the (even) ASID for p's address space, allocating one if
+// it has none in the current generation, and flushing whatever
+// this hart's TLB might hold stale for it. Called with
+// interrupts off.
+static uint64
+asidget(struct proc *p)
+{
+  struct tgroup *tg = p->tg;
+  struct cpu *c = mycpu();
+  uint bit = 1 << cpuid();
+  uint64 gen;
+
+  // the common case: nothing to allocate or flush.
+  // if another hart starts a new generation meanwhile, this
+  // hart still flushes before it uses the new generation.
+  gen = asids.gen;
+  if((tg->asid >> ASIDBITS) == gen && c->asidgen == gen &&
+     (tg->cpus & bit) && (tg->stale & bit) == 0)
+    return tg->asid & ASIDMASK;
+
+  acquire(&asids.lock);
+  if((tg->asid >> ASIDBITS) != asids.gen){
+    if(asids.next + 1 > asids.max){
+      asids.gen++;
+      asids.next = 2;
+    }
+    tg->asid = (asids.gen << ASIDBITS) | asids.next;
+    asids.next += 2;
+    tg->cpus = 0;
+    tg->stale = 0;
+  }
+  if(c->asidgen != asids.gen){
+    // entries from the last generation may carry ASIDs
+    // that now name other address spaces.
+    sfence_vma();
+    c->asidgen = asids.gen;
+  }
+  __sync_fetch_and_or(&tg->cpus, bit);
+  if(tg->stale & bit){
+    __sync_fetch_and_and(&tg->stale, ~bit);
+    sfence_vma_asid(tg->asid & ASIDMASK);
+    sfence_vma_asid((tg->asid & ASIDMASK) + 1);
+  }
+  release(&asids.lock);
+
+  return tg->asid & ASIDMASK;
+}
+
+// Switch this hart to p's kernel page table, or back to the
+// global one if p is 0.
+void
+asidswitch(struct proc *p)
+{
+  if(p == 0){
+    w_satp(MAKE_SATP(kernel_pagetable, 0));
+  } else if(asids.max == 0){
+    w_satp(MAKE_SATP(p->kpagetable, 0));
+  } else {
+    push_off();
+    w_satp(MAKE_SATP(p->kpagetable, asidget(p) + 1));
+    pop_off();
+  }
+  if(asids.max == 0)
+    sfence_vma();
+}
+
+// Return the satp value with which p should enter user space.
+// Called with interrupts off, before usertrapret() records
+// the kernel satp for the trampoline: if p's address space
+// has just taken a new ASID, this switches the kernel page
+// table to the new ASID too.
+uint64
+usersatp(struct proc *p)
+{
+  uint64 asid, ksatp;
+
+  if(asids.max == 0)
+    return MAKE_SATP(p->pagetable, 0);
+
+  asid = asidget(p);
+  ksatp = MAKE_SATP(p->kpagetable, asid + 1);
+  if(r_satp() != ksatp)
+    w_satp(ksatp);
+  return MAKE_SATP(p->pagetable, asid);
+}
+
+// Called after unmapping pages of tg's address space.
+// Flushes its TLB entries on this hart, and on the other harts
+// that may cache them before they next run it.
+void
+asidflush(struct tgroup *tg)
+{
+  uint64 asid = tg->asid;
+
+  if(asids.max == 0){
+    // every page table runs with ASID 0, and the other harts
+    // flush whenever they switch to it.
+    sfence_vma();
+    return;
+  }
+  if(asid == 0)
+    return;
+
+  push_off();
+  __sync_fetch_and_or(&tg->stale, tg->cpus & ~(1 << cpuid()));
+  sfence_vma_asid(asid & ASIDMASK);
+  sfence_vma_asid((asid & ASIDMASK) + 1);
+  pop_off();
+}
@@ -0,0 +1,7 @@
+// a system call for syscall_batch() to make.
+struct sysrec {
+  int num;          // SYS_*
+  int arg0from;     // if >= 0, args[0] is that earlier record's ret
+  uint64 args[6];
+  uint64 ret;       // the call's return value
+};
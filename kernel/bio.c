@@ -21,6 +21,7 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstat.h"
 
 #define NBUCKET 13
 #define HASH(i) (i % NBUCKET)
@@ -53,6 +54,7 @@ void binit(void)
     // 初始化散列桶的自旋锁
     snprintf(lockname, sizeof(lockname), "bcache_%d", i);
     initlock(&bcache.buckets[i].lock, lockname);
+    lockmode(&bcache.buckets[i].lock, LK_TICKET);
 
     // 初始化散列桶的头节点
     bcache.buckets[i].head.prev = &bcache.buckets[i].head;
@@ -87,6 +89,7 @@ bget(uint dev, uint blockno)
     if (b->dev == dev && b->blockno == blockno)
     {
       b->refcnt++;
+      kstat(KS_BHIT, blockno);
 
       acquire(&tickslock);
       b->time_stamp = ticks;
@@ -99,6 +102,7 @@ bget(uint dev, uint blockno)
   }
 
   // Not cached.
+  kstat(KS_BMISS, blockno);
   b = 0;
   int cycle = 0, t = id_b;
   struct buf *tmp;
@@ -17,9 +17,11 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "poll.h"
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
+#include "rusage.h"
 #include "proc.h"
 
 #define BACKSPACE 0x100
@@ -50,6 +52,8 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+
+  struct pollq pollq;
 } cons;
 
 //
@@ -60,11 +64,21 @@ consolewrite(int user_src, uint64 src, int n)
 {
   int i;
 
+  // fault the source in before taking the lock, so that the
+  // copy rarely has to let go of it; vmretry() covers the rest.
+  if(user_src)
+    vmtouch(src, n, PTE_R);
   acquire(&cons.lock);
   for(i = 0; i < n; i++){
     char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+    if(either_copyin(&c, user_src, src+i, 1) == -1){
+      // the page may be program text not yet read in, or in swap.
+      if(user_src && vmretry(src+i, PTE_R, &cons.lock) == 0){
+        i--;
+        continue;
+      }
       break;
+    }
     uartputc(c);
   }
   release(&cons.lock);
@@ -111,8 +125,13 @@ consoleread(int user_dst, uint64 dst, int n)
 
     // copy the input byte to the user-space buffer.
     cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
+    if(either_copyout(user_dst, dst, &cbuf, 1) == -1){
+      // put it back; the page may be in swap.
+      cons.r--;
+      if(user_dst && vmretry(dst, PTE_W, &cons.lock) == 0)
+        continue;
       break;
+    }
 
     dst++;
     --n;
@@ -128,6 +147,24 @@ consoleread(int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+//
+// poll() on the console: is there a line to read?
+// writes never wait for long.
+//
+int
+consolepoll(struct pollent *e)
+{
+  int r = POLLOUT;
+
+  acquire(&cons.lock);
+  if(e)
+    pollqueue(&cons.pollq, e);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -172,6 +209,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwakeup(&cons.pollq);
       }
     }
     break;
@@ -187,8 +225,9 @@ consoleinit(void)
 
   uartinit();
 
-  // connect read and write system calls
-  // to consoleread and consolewrite.
+  // connect read, write and poll system calls
+  // to consoleread, consolewrite and consolepoll.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
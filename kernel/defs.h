@@ -2,17 +2,32 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
 struct pipe;
+struct pollent;
+struct pollq;
 struct proc;
+struct rcu_head;
 struct spinlock;
 struct sleeplock;
+struct rwsleeplock;
+struct rwspinlock;
 struct stat;
 struct superblock;
+struct tgroup;
+struct tgvisit;
 #ifdef LAB_NET
 struct mbuf;
 struct sock;
 #endif
 
+// asid.c
+void            asidinit(void);
+void            asidnew(struct tgroup*);
+void            asidswitch(struct proc*);
+uint64          usersatp(struct proc*);
+void            asidflush(struct tgroup*);
+
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
@@ -25,10 +40,17 @@ void            bunpin(struct buf*);
 void            consoleinit(void);
 void            consoleintr(int);
 void            consputc(int);
+int             consolepoll(struct pollent*);
 
 // exec.c
 int             exec(char*, char**);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int);
+int             futexwake(uint64, int);
+int             futexbusy(uint64);
+
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
@@ -37,6 +59,10 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filesplice(struct file*, struct file*, int);
+int             filepoll(struct file*, struct pollent*);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filewritev(struct file*, struct iovec*, int, int);
 
 // fs.c
 void            fsinit(int);
@@ -46,6 +72,7 @@ struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
+void            ilockshared(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
@@ -63,10 +90,48 @@ void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// kstat.c
+void            kstatinit(void);
+void            kstat(int, uint64);
+int             kstatctl(char*);
+int             statskstat(char*, int);
+int             ktraceread(int, uint64, int);
+
+// prof.c
+void            profinit(void);
+int             proftick(void);
+
+// rcu.c
+void            rcuinit(void);
+void            rcu_read_lock(void);
+void            rcu_read_unlock(void);
+void            rcu_qs(void);
+void            rcu_idle(int);
+void            synchronize_rcu(void);
+void            call_rcu(struct rcu_head*, void (*)(struct rcu_head*));
+void            kfree_rcu(void*);
+void            rcud(void);
+int             rcutest(void);
+
+// ioring.c
+void            ioringinit(void);
+void            ioringstart(void);
+uint64          ioringsetup(void);
+int             ioringenter(int);
+void            ioringexit(struct tgroup*);
+
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kallocmega(void);
+void            kfreemega(void *);
+void            kdup(void *);
+int             krefs(void *);
+int             kfreepages(void);
+int             kmemlow(void);
+void            kshrinker(char *, int (*)(int));
+int             kshrink(int);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -74,11 +139,30 @@ void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
 
+// pcache.c
+void            pcacheinit(void);
+uint64          pcachelookup(struct inode*, uint);
+uint64          pcacheget(struct inode*, uint, uint);
+void            pcacheinval(struct inode*);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipereadspan(struct pipe*, int, int, char**);
+void            pipereaddone(struct pipe*, int);
+int             pipewritespan(struct pipe*, int, char**);
+void            pipewritedone(struct pipe*, int);
+int             pipesize(struct pipe*, int);
+int             pipepoll(struct pipe*, int, struct pollent*);
+
+// poll.c
+void            pollinit(void);
+void            pollqueue(struct pollq*, struct pollent*);
+void            pollwakeup(struct pollq*);
+void            polltick(void);
+int             poll(uint64, int, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -89,10 +173,22 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
 int             growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
-void            proc_freepagetable(pagetable_t, uint64);
+void            proc_freepagetable(pagetable_t, uint64, uint64);
+void            proc_freevm(struct tgroup *, pagetable_t, pagetable_t, uint64, uint64);
+int             tgsplit(struct proc *);
+void            tgsetsz(struct proc *, uint64);
+struct proc*    tgfreeze(struct tgroup *);
+void            tgthaw(struct tgroup *);
+void            tgstop(struct proc *);
+int             tgjoin(struct tgroup *, struct inode *, struct tgvisit *);
+void            tgleave(struct tgvisit *);
+void            kproc(void (*)(void), char *);
 int             kill(int);
+int             syslatcopy(int, int, uint*);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -103,19 +199,46 @@ void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
+int             wait2(uint64, uint64);
+int             procinfo(uint64, int);
 void            wakeup(void*);
+void            wakeproc(struct proc*, void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
+// shm.c
+void            shminit(void);
+uint64          shmat(int, int);
+int             shmdt(uint64);
+
+// swap.c
+void            swapinit(void);
+void            swapdup(uint64);
+void            swapput(uint64);
+int             swapin(struct proc*, uint64, int);
+void            swapd(void);
+int             swapwait(void);
+void            swapkick(void);
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// usercopy.S
+int             ucopy(void*, void*, uint64);
+int             ucopystr(char*, char*, uint64);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            lockmode(struct spinlock*, int);
+void            initrwlock(struct rwspinlock*, char*);
+void            acquireread(struct rwspinlock*);
+void            releaseread(struct rwspinlock*);
+void            acquirewrite(struct rwspinlock*);
+void            releasewrite(struct rwspinlock*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
@@ -128,6 +251,11 @@ void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            initrwsleeplock(struct rwsleeplock*, char*);
+void            acquirereadsleep(struct rwsleeplock*);
+void            acquirewritesleep(struct rwsleeplock*);
+void            releaserwsleep(struct rwsleeplock*);
+int             holdingrwsleep(struct rwsleeplock*, int);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -138,6 +266,11 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// sysfile.c
+int             fileopen(char*, int);
+int             fdclose(int);
+struct file*    fdget(int);
+
 // syscall.c
 int             argint(int, int*);
 int             argstr(int, char*, int);
@@ -145,6 +278,13 @@ int             argaddr(int, uint64 *);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+char*           syscallname(int);
+void            systraceinit(void);
+
+// timer.c
+void            timersinit(void);
+int             timersleep(uint64);
+int             timerintr(void);
 
 // trap.c
 extern uint     ticks;
@@ -164,16 +304,28 @@ int             uartgetc(void);
 void            kvminit(void);
 void            kvminithart(void);
 void            kvmmap(uint64, uint64, uint64, int);
+pagetable_t     kvmcreate(void);
+void            kvmsync(pagetable_t, pagetable_t);
+void            kvmfree(pagetable_t);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
 void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
+uint64          uvmdeallocsync(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
-void            uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmunmap(pagetable_t, uint64, uint64, int);
+void            uvmunmapsync(pagetable_t, uint64, uint64);
 void            uvmclear(pagetable_t, uint64);
 uint64          walkaddr(pagetable_t, uint64);
+void            cursorinit(struct ptcursor*, pagetable_t);
+pte_t*          cursorwalk(struct ptcursor*, uint64, int, uint64*);
+uint64          cursoraddr(struct ptcursor*, uint64);
+int             uvmcheck(pagetable_t, uint64, int);
+int             vmfault(struct proc*, uint64, int);
+int             vmretry(uint64, int, struct spinlock*);
+int             vmtouch(uint64, uint64, int);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
@@ -187,6 +339,7 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_rwpage(uint, void *, int);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
@@ -3,11 +3,13 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 #include "elf.h"
 
 static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+static int textmap(pagetable_t pagetable, struct textseg *t);
 
 int
 exec(char *path, char **argv)
@@ -19,15 +21,20 @@ exec(char *path, char **argv)
   struct inode *ip;
   struct proghdr ph;
   pagetable_t pagetable = 0, oldpagetable;
+  pagetable_t kpagetable = 0, oldkpagetable;
+  struct tgroup *oldtg;
+  struct textseg text;
+  struct inode *oldtext = 0;
   struct proc *p = myproc();
 
+  memset(&text, 0, sizeof(text));
   begin_op();
 
   if((ip = namei(path)) == 0){
     end_op();
     return -1;
   }
-  ilock(ip);
+  ilockshared(ip);
 
   // Check ELF header
   if(readi(ip, 0, (uint64)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -48,6 +55,25 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
+    if(ph.vaddr + ph.memsz > PLIC)
+      goto bad;
+    if((ph.flags & ELF_PROG_FLAG_WRITE) == 0 && text.ip == 0 && ph.vaddr >= sz &&
+       ph.vaddr % PGSIZE == 0 && ph.off % PGSIZE == 0){
+      // read-only text: map what the text cache already has,
+      // and leave the rest for vmfault() to bring in if used.
+      text.ip = idup(ip);
+      text.va = ph.vaddr;
+      text.end = ph.vaddr + ph.memsz;
+      text.fileend = ph.vaddr + ph.filesz;
+      text.off = ph.off;
+      text.perm = PTE_U | PTE_R;
+      if(ph.flags & ELF_PROG_FLAG_EXEC)
+        text.perm |= PTE_X;
+      if(textmap(pagetable, &text) < 0)
+        goto bad;
+      sz = text.end;
+      continue;
+    }
     uint64 sz1;
     if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
       goto bad;
@@ -63,10 +89,13 @@ exec(char *path, char **argv)
 
   p = myproc();
   uint64 oldsz = p->sz;
+  uint64 oldtrapframeva = p->trapframeva;
 
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
   sz = PGROUNDUP(sz);
+  if(sz + 2*PGSIZE > PLIC)
+    goto bad;
   uint64 sz1;
   if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE)) == 0)
     goto bad;
@@ -108,26 +137,81 @@ exec(char *path, char **argv)
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
     
+  // A kernel page table that maps the new user memory.
+  if((kpagetable = kvmcreate()) == 0)
+    goto bad;
+  kvmsync(kpagetable, pagetable);
+
+  // Leave the old address space to any other threads sharing it.
+  oldtg = p->tg;
+  if(tgsplit(p) < 0)
+    goto bad;
+  if(p->tg == oldtg)
+    ioringexit(oldtg);  // the I/O ring belongs to the old image
+
   // Commit to the user image.
   oldpagetable = p->pagetable;
+  oldkpagetable = p->kpagetable;
   p->pagetable = pagetable;
+  p->kpagetable = kpagetable;
   p->sz = sz;
+  p->trapframeva = TRAPFRAME;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  if(p->tg == oldtg){
+    oldtext = p->tg->text.ip;
+    asidnew(p->tg);
+  }
+  p->tg->text = text;
+  asidswitch(p);
+  if(p->tg == oldtg){
+    kvmfree(oldkpagetable);
+    proc_freepagetable(oldpagetable, oldtrapframeva, oldsz);
+  } else
+    proc_freevm(oldtg, oldpagetable, oldkpagetable, oldtrapframeva, oldsz);
+  if(oldtext){
+    begin_op();
+    iput(oldtext);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
  bad:
+  if(kpagetable)
+    kvmfree(kpagetable);
   if(pagetable)
-    proc_freepagetable(pagetable, sz);
+    proc_freepagetable(pagetable, TRAPFRAME, sz);
   if(ip){
     iunlockput(ip);
     end_op();
   }
+  if(text.ip){
+    begin_op();
+    iput(text.ip);
+    end_op();
+  }
   return -1;
 }
 
+// Map the pages of segment t that the text cache already
+// holds, so a program run again soon faults on none of them.
+static int
+textmap(pagetable_t pagetable, struct textseg *t)
+{
+  uint64 a, pa;
+
+  for(a = t->va; a < t->end; a += PGSIZE){
+    if((pa = pcachelookup(t->ip, t->off + (a - t->va))) == 0)
+      continue;
+    if(mappages(pagetable, a, PGSIZE, pa, t->perm) != 0){
+      kfree((void*)pa);
+      return -1;
+    }
+  }
+  return 0;
+}
+
 // Load a program segment into pagetable at virtual address va.
 // va must be page-aligned
 // and the pages from va to va+sz must already be mapped.
@@ -137,12 +221,14 @@ loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz
 {
   uint i, n;
   uint64 pa;
+  struct ptcursor c;
 
   if((va % PGSIZE) != 0)
     panic("loadseg: va must be page aligned");
 
+  cursorinit(&c, pagetable);
   for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
+    pa = cursoraddr(&c, va + i);
     if(pa == 0)
       panic("loadseg: address should exist");
     if(sz - i < PGSIZE)
@@ -11,18 +11,27 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "stat.h"
+#include "rusage.h"
 #include "proc.h"
+#include "poll.h"
+#include "uio.h"
 
 struct devsw devsw[NDEV];
+// ftable.lock is held to write while allocating or releasing a
+// file, and to read while filedup() raises a reference count,
+// which it does atomically; so fork() and dup() don't wait for
+// each other.
 struct {
-  struct spinlock lock;
+  struct rwspinlock lock;
   struct file file[NFILE];
 } ftable;
 
 void
 fileinit(void)
 {
-  initlock(&ftable.lock, "ftable");
+  initrwlock(&ftable.lock, "ftable");
+  for(int i = 0; i < NFILE; i++)
+    initsleeplock(&ftable.file[i].offlock, "fileoff");
 }
 
 // Allocate a file structure.
@@ -31,15 +40,15 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
+  acquirewrite(&ftable.lock);
   for(f = ftable.file; f < ftable.file + NFILE; f++){
     if(f->ref == 0){
       f->ref = 1;
-      release(&ftable.lock);
+      releasewrite(&ftable.lock);
       return f;
     }
   }
-  release(&ftable.lock);
+  releasewrite(&ftable.lock);
   return 0;
 }
 
@@ -47,11 +56,11 @@ filealloc(void)
 struct file*
 filedup(struct file *f)
 {
-  acquire(&ftable.lock);
+  acquireread(&ftable.lock);
   if(f->ref < 1)
     panic("filedup");
-  f->ref++;
-  release(&ftable.lock);
+  __sync_fetch_and_add(&f->ref, 1);
+  releaseread(&ftable.lock);
   return f;
 }
 
@@ -61,17 +70,17 @@ fileclose(struct file *f)
 {
   struct file ff;
 
-  acquire(&ftable.lock);
+  acquirewrite(&ftable.lock);
   if(f->ref < 1)
     panic("fileclose");
   if(--f->ref > 0){
-    release(&ftable.lock);
+    releasewrite(&ftable.lock);
     return;
   }
   ff = *f;
   f->ref = 0;
   f->type = FD_NONE;
-  release(&ftable.lock);
+  releasewrite(&ftable.lock);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -91,7 +100,7 @@ filestat(struct file *f, uint64 addr)
   struct stat st;
   
   if(f->type == FD_INODE || f->type == FD_DEVICE){
-    ilock(f->ip);
+    ilockshared(f->ip);
     stati(f->ip, &st);
     iunlock(f->ip);
     if(copyout(p->pagetable, addr, (char *)&st, sizeof(st)) < 0)
@@ -101,27 +110,111 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
-int
-fileread(struct file *f, uint64 addr, int n)
+// Read from inode file f at *off, advancing it, into the niov
+// buffers in iov, which are at user virtual addresses if user_dst
+// is set and kernel addresses if not, all under one ilockshared().
+// Stops at the first short read. Returns the number of bytes read,
+// or -1 if none could be.
+// Reads of different files, or at given offsets, of the same inode
+// can go on at once; reads at f->off itself take turns, so that
+// each gets the next bytes.
+static int
+readiov(struct file *f, int user_dst, struct iovec *iov, int niov, uint *off)
 {
-  int r = 0;
+  int i, r = 0, tot = 0;
 
-  if(f->readable == 0)
-    return -1;
+  if(off == &f->off)
+    acquiresleep(&f->offlock);
+  ilockshared(f->ip);
+  for(i = 0; i < niov; i++){
+    if((r = readi(f->ip, user_dst, (uint64)iov[i].base, *off, iov[i].len)) > 0){
+      *off += r;
+      tot += r;
+    }
+    if(r != iov[i].len)
+      break;
+  }
+  iunlock(f->ip);
+  if(off == &f->off)
+    releasesleep(&f->offlock);
+  return (r < 0 && tot == 0) ? -1 : tot;
+}
+
+// Write the niov buffers in iov to inode file f at *off, advancing
+// it; like readiov(), but in as few log transactions as the
+// transaction size allows. Returns the number of bytes written,
+// or -1 if the writes fail.
+static int
+writeiov(struct file *f, int user_src, struct iovec *iov, int niov, uint *off)
+{
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size, including
+  // i-node, indirect block, allocation blocks,
+  // and 2 blocks of slop for non-aligned writes.
+  // consecutive writes, as here, touch no more blocks
+  // than one write of their total size.
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  int i = 0, r = 0, tot = 0;
+  uint64 done = 0;   // bytes of iov[i] written
+  int faulted;       // a copy failed, at fault
+  uint64 fault = 0;
+
+  while(i < niov && r >= 0){
+    // fault the source in now: writei() can't read program text
+    // in while it holds f->ip locked.
+    if(user_src)
+      vmtouch((uint64)iov[i].base + done, iov[i].len - done < max ? iov[i].len - done : max, PTE_R);
+    faulted = 0;
+    begin_op();
+    ilock(f->ip);
+    for(int room = max; i < niov && room > 0; ){
+      int n1 = iov[i].len - done;
+      if(n1 > room)
+        n1 = room;
+      if((r = writei(f->ip, user_src, (uint64)iov[i].base + done, *off, n1)) > 0)
+        *off += r;
+      if(r < 0)
+        break;
+      tot += r;
+      room -= r;
+      if((done += r) == iov[i].len){
+        i++;
+        done = 0;
+      }
+      if(r != n1){
+        faulted = 1;
+        fault = (uint64)iov[i].base + done;
+        break;
+      }
+    }
+    iunlock(f->ip);
+    end_op();
+    // retry a failed copy once the page is in, if it can be.
+    if(faulted && (!user_src || vmfault(myproc(), fault, PTE_R) < 0))
+      r = -1;
+  }
+  return r < 0 ? -1 : tot;
+}
+
+// Read from file f to dst, which is a user virtual address if
+// user_dst is set and a kernel address if not; only a user
+// address if f is a pipe.
+static int
+fileread1(struct file *f, int user_dst, uint64 dst, int n)
+{
+  int r = 0;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, dst, n);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    r = devsw[f->major].read(user_dst, dst, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    struct iovec iov = { (void*)dst, n };
+    r = readiov(f, user_dst, &iov, 1, &f->off);
   } else {
     panic("fileread");
   }
@@ -129,54 +222,202 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Write to file f from src, which is a user virtual address if
+// user_src is set and a kernel address if not; only a user
+// address if f is a pipe.
+static int
+filewrite1(struct file *f, int user_src, uint64 src, int n)
+{
+  int ret = 0;
+
+  if(f->type == FD_PIPE){
+    ret = pipewrite(f->pipe, src, n);
+  } else if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+      return -1;
+    ret = devsw[f->major].write(user_src, src, n);
+  } else if(f->type == FD_INODE){
+    struct iovec iov = { (void*)src, n };
+    ret = (writeiov(f, user_src, &iov, 1, &f->off) == n ? n : -1);
+  } else {
+    panic("filewrite");
+  }
+
+  return ret;
+}
+
+// Read from file f.
+// addr is a user virtual address.
+int
+fileread(struct file *f, uint64 addr, int n)
+{
+  int r = 0;
+
+  if(f->readable == 0)
+    return -1;
+
+  if((r = fileread1(f, 1, addr, n)) > 0)
+    myproc()->ru.rbytes += r;
+
+  return r;
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  int ret = 0;
 
   if(f->writable == 0)
     return -1;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
+  if((ret = filewrite1(f, 1, addr, n)) > 0)
+    myproc()->ru.wbytes += ret;
+
+  return ret;
+}
+
+
+// Read from file f into the niov buffers in iov, whose addresses
+// are user virtual addresses: from offset off of an inode file, or
+// at f's own offset if off is -1. Returns the number of bytes read,
+// or -1. Counts what it reads in the process's rusage, as read()
+// does.
+int
+filereadv(struct file *f, struct iovec *iov, int niov, int off)
+{
+  uint uoff = off;
+  int i, r, tot = 0;
+
+  if(f->readable == 0 || niov < 0 || niov > MAXIOV)
+    return -1;
+  for(i = 0; i < niov; i++)
+    if(iov[i].len > MAXFILE*BSIZE)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+
+  if(off >= 0){
+    tot = f->type == FD_INODE ? readiov(f, 1, iov, niov, &uoff) : -1;
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
+    tot = readiov(f, 1, iov, niov, &f->off);
+  } else {
+    // a pipe or device: go on to the next buffer only if
+    // this one filled up and there is more to read now.
+    for(i = 0; i < niov; i++){
+      if(i > 0 && (filepoll(f, 0) & POLLIN) == 0)
+        break;
+      if((r = fileread1(f, 1, (uint64)iov[i].base, iov[i].len)) < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      tot += r;
+      if(r != iov[i].len)
+        break;
+    }
+  }
+  if(tot > 0)
+    myproc()->ru.rbytes += tot;
+  return tot;
+}
+
+// Write the niov buffers in iov, at user virtual addresses, to
+// file f: at offset off of an inode file, or at f's own offset
+// if off is -1. Returns the number of bytes written, or -1.
+// Counts what it writes in the process's rusage, as write() does.
+int
+filewritev(struct file *f, struct iovec *iov, int niov, int off)
+{
+  uint uoff = off;
+  int i, r, tot = 0;
+
+  if(f->writable == 0 || niov < 0 || niov > MAXIOV)
+    return -1;
+  for(i = 0; i < niov; i++)
+    if(iov[i].len > MAXFILE*BSIZE)
+      return -1;
+
+  if(off >= 0){
+    tot = f->type == FD_INODE ? writeiov(f, 1, iov, niov, &uoff) : -1;
+  } else if(f->type == FD_INODE){
+    tot = writeiov(f, 1, iov, niov, &f->off);
+  } else {
+    for(i = 0; i < niov; i++){
+      if((r = filewrite1(f, 1, (uint64)iov[i].base, iov[i].len)) != iov[i].len){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      tot += r;
+    }
+  }
+  if(tot > 0)
+    myproc()->ru.wbytes += tot;
+  return tot;
+}
+
+// Which of the poll() events hold for f. If e is not 0, queue
+// it to be woken when that may change; files that are always
+// ready ignore it.
+int
+filepoll(struct file *f, struct pollent *e)
+{
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable, e);
+  if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV && devsw[f->major].poll)
+    return devsw[f->major].poll(e);
+  return POLLIN | POLLOUT;
+}
 
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
+// Move up to n bytes from file in to file out, one of which must
+// be a pipe and the other a device or inode, straight between the
+// file and the pipe's buffer. Waits for data only as read() would
+// on in, and for space as write() would on out.
+// Returns the number of bytes moved, or -1.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  int m = 0, r = 0, i = 0;
+  char *p;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
 
+  if(in->type == FD_PIPE && (out->type == FD_DEVICE || out->type == FD_INODE)){
+    while(i < n){
+      if((m = pipereadspan(in->pipe, n - i, i == 0, &p)) <= 0){
+        if(m < 0)
+          return -1;
+        break;
+      }
+      r = filewrite1(out, 0, (uint64)p, m);
+      pipereaddone(in->pipe, r > 0 ? r : 0);
+      if(r < 0)
+        break;
+      i += r;
+      if(r < m)
+        break;
+    }
+  } else if(out->type == FD_PIPE && (in->type == FD_DEVICE || in->type == FD_INODE)){
+    while(i < n){
+      if((m = pipewritespan(out->pipe, n - i, &p)) < 0)
+        break;
+      r = fileread1(in, 0, (uint64)p, m);
+      pipewritedone(out->pipe, r > 0 ? r : 0);
       if(r < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
       i += r;
+      if(r < m)
+        break;  // end of file, or a device with no more for now.
     }
-    ret = (i == n ? n : -1);
   } else {
-    panic("filewrite");
+    return -1;
   }
 
-  return ret;
+  // an error ends the move; it fails only if nothing moved.
+  if(i == 0 && (m < 0 || r < 0))
+    return -1;
+  myproc()->ru.rbytes += i;
+  myproc()->ru.wbytes += i;
+  return i;
 }
-
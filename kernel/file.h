@@ -13,6 +13,7 @@ struct file {
   struct sock *sock; // FD_SOCK
 #endif
   uint off;          // FD_INODE
+  struct sleeplock offlock; // FD_INODE: one read at off at a time
   short major;       // FD_DEVICE
 };
 
@@ -25,8 +26,9 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
-  struct sleeplock lock; // protects everything below here
+  struct rwsleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  int cachedtext;     // text cache may hold pages of it; see pcache.c
 
   short type;         // copy of disk inode
   short major;
@@ -36,13 +38,24 @@ struct inode {
   uint addrs[NDIRECT+1];
 };
 
+struct pollent;
+
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct pollent*);  // 0 if always ready
+};
+
+// processes in poll() waiting for a pipe or device; see poll.c.
+struct pollq {
+  struct pollent *head;
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
 #define STATS   2
+#define TRACE   3
+#define PROF    4
+#define SYSTRACE 5
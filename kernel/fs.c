@@ -15,6 +15,7 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -166,13 +167,20 @@ bfree(int dev, uint b)
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
+// It is a reader-writer lock: iget() and idup() only read which
+// entry holds what, so they hold it to read and raise ip->ref
+// atomically. Anything that lowers ip->ref, or recycles an
+// entry, holds it to write.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+// ilockshared() holds it to read, for code that only reads the
+// inode and its content, so that processes reading the same
+// file or directory needn't wait for each other.
 
 struct {
-  struct spinlock lock;
+  struct rwspinlock lock;
   struct inode inode[NINODE];
 } icache;
 
@@ -181,9 +189,9 @@ iinit()
 {
   int i = 0;
   
-  initlock(&icache.lock, "icache");
+  initrwlock(&icache.lock, "icache");
   for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
+    initrwsleeplock(&icache.inode[i].lock, "inode");
   }
 }
 
@@ -244,14 +252,25 @@ iget(uint dev, uint inum)
 {
   struct inode *ip, *empty;
 
-  acquire(&icache.lock);
-
   // Is the inode already cached?
+  acquireread(&icache.lock);
+  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
+    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+      __sync_fetch_and_add(&ip->ref, 1);
+      releaseread(&icache.lock);
+      return ip;
+    }
+  }
+  releaseread(&icache.lock);
+
+  // No; look again, as another process may have cached it
+  // since, and take an empty entry if not.
+  acquirewrite(&icache.lock);
   empty = 0;
   for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
     if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
       ip->ref++;
-      release(&icache.lock);
+      releasewrite(&icache.lock);
       return ip;
     }
     if(empty == 0 && ip->ref == 0)    // Remember empty slot.
@@ -267,7 +286,10 @@ iget(uint dev, uint inum)
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
-  release(&icache.lock);
+  // the text cache outlives the entry, and may still hold
+  // pages of this inode from an earlier one.
+  ip->cachedtext = 1;
+  releasewrite(&icache.lock);
 
   return ip;
 }
@@ -277,9 +299,9 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&icache.lock);
-  ip->ref++;
-  release(&icache.lock);
+  acquireread(&icache.lock);
+  __sync_fetch_and_add(&ip->ref, 1);
+  releaseread(&icache.lock);
   return ip;
 }
 
@@ -294,7 +316,7 @@ ilock(struct inode *ip)
   if(ip == 0 || ip->ref < 1)
     panic("ilock");
 
-  acquiresleep(&ip->lock);
+  acquirewritesleep(&ip->lock);
 
   if(ip->valid == 0){
     bp = bread(ip->dev, IBLOCK(ip->inum, sb));
@@ -312,14 +334,35 @@ ilock(struct inode *ip)
   }
 }
 
-// Unlock the given inode.
+// Lock the given inode to read it and its content, alongside
+// other readers; the caller must not change either. Only
+// readi(), stati() and dirlookup() may be used under this lock.
+void
+ilockshared(struct inode *ip)
+{
+  if(ip == 0 || ip->ref < 1)
+    panic("ilockshared");
+
+  acquirereadsleep(&ip->lock);
+  if(ip->valid == 0){
+    // it must be read in from disk, which only a writer may do.
+    // once read, it stays valid while the caller holds a reference.
+    releaserwsleep(&ip->lock);
+    ilock(ip);
+    releaserwsleep(&ip->lock);
+    acquirereadsleep(&ip->lock);
+  }
+}
+
+// Unlock the given inode, whether ilock() or
+// ilockshared() locked it.
 void
 iunlock(struct inode *ip)
 {
-  if(ip == 0 || !holdingsleep(&ip->lock) || ip->ref < 1)
+  if(ip == 0 || !holdingrwsleep(&ip->lock, 1) || ip->ref < 1)
     panic("iunlock");
 
-  releasesleep(&ip->lock);
+  releaserwsleep(&ip->lock);
 }
 
 // Drop a reference to an in-memory inode.
@@ -332,29 +375,29 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
-  acquire(&icache.lock);
+  acquirewrite(&icache.lock);
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
 
     // ip->ref == 1 means no other process can have ip locked,
-    // so this acquiresleep() won't block (or deadlock).
-    acquiresleep(&ip->lock);
+    // so this acquirewritesleep() won't block (or deadlock).
+    acquirewritesleep(&ip->lock);
 
-    release(&icache.lock);
+    releasewrite(&icache.lock);
 
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
 
-    releasesleep(&ip->lock);
+    releaserwsleep(&ip->lock);
 
-    acquire(&icache.lock);
+    acquirewrite(&icache.lock);
   }
 
   ip->ref--;
-  release(&icache.lock);
+  releasewrite(&icache.lock);
 }
 
 // Common idiom: unlock, then put.
@@ -434,6 +477,8 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  if(ip->type == T_FILE)
+    pcacheinval(ip);
 }
 
 // Copy stat information from inode.
@@ -495,14 +540,21 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
+      // a bad address, or program text that the fault could not
+      // read in while the caller holds ip locked (see pcacheget());
+      // the caller can tell from the short count.
       brelse(bp);
-      n = -1;
+      n = tot;
       break;
     }
     log_write(bp);
     brelse(bp);
   }
 
+  // cached program text from this file is now out of date.
+  if(tot > 0 && ip->type == T_FILE)
+    pcacheinval(ip);
+
   if(n > 0){
     if(off > ip->size)
       ip->size = off;
@@ -635,7 +687,7 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
-    ilock(ip);
+    ilockshared(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
       return 0;
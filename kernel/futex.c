@@ -0,0 +1,153 @@
+// Futex-style waiting for user threads.
+//
+// futexwait() puts the caller to sleep on a 4-byte word of user
+// memory, provided the word still holds the value the caller
+// expects; futexwake() wakes threads sleeping on that word.
+// Waiters are keyed by the word's physical address, so threads
+// of one address space (see clone() in proc.c) find each other
+// regardless of which page table they came through.
+//
+// Waiters queue in a hash table of buckets, each with its own
+// lock, so a wake touches only the threads waiting on words
+// that hash alike rather than scanning the whole proc table.
+// User code only enters the kernel when it must block or wake
+// someone; see the mutex in user/ulib.c.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NFUTEX 31
+#define FUTEXHASH(pa) (((pa) >> 2) % NFUTEX)
+
+// lives on the waiting thread's kernel stack.
+struct futexwaiter {
+  uint64 pa;                 // physical address of the word
+  struct proc *p;            // waiting thread; 0 once woken
+  struct futexwaiter *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct futexwaiter *head;
+} futex[NFUTEX];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEX; i++)
+    initlock(&futex[i].lock, "futex");
+}
+
+// Return the physical address of the aligned word at user
+// address addr in the current process, or 0 if it isn't mapped.
+// Reads the page back if it is in swap. It can't go to swap again
+// while this thread runs; see tgfreeze() in proc.c.
+static uint64
+futexaddr(uint64 addr)
+{
+  struct proc *p = myproc();
+  uint64 va0, pa0;
+
+  if(addr % sizeof(int) != 0)
+    return 0;
+  va0 = PGROUNDDOWN(addr);
+  if((pa0 = walkaddr(p->pagetable, va0)) == 0){
+    if(vmfault(p, addr, PTE_R) < 0 ||
+       (pa0 = walkaddr(p->pagetable, va0)) == 0)
+      return 0;
+  }
+  return pa0 + (addr - va0);
+}
+
+// Sleep until a futexwake() on addr, unless the word at addr
+// no longer holds val. Either way the caller should re-check
+// the word. Returns -1 if addr is bad or the process is killed.
+int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct futexwaiter w, **pw;
+  uint64 pa;
+  int h;
+
+  if((pa = futexaddr(addr)) == 0)
+    return -1;
+  h = FUTEXHASH(pa);
+
+  // holding the bucket lock across the check and the sleep
+  // means a futexwake() can't slip in between them.
+  acquire(&futex[h].lock);
+  if(*(int*)pa == val && !p->killed){
+    w.pa = pa;
+    w.p = p;
+    w.next = futex[h].head;
+    futex[h].head = &w;
+    sleep(&w, &futex[h].lock);
+    if(w.p){
+      // not woken by futexwake() (e.g. killed); dequeue.
+      for(pw = &futex[h].head; *pw; pw = &(*pw)->next){
+        if(*pw == &w){
+          *pw = w.next;
+          break;
+        }
+      }
+    }
+  }
+  release(&futex[h].lock);
+
+  return p->killed ? -1 : 0;
+}
+
+// Is a thread waiting on a word in the page at pa? Such a page
+// must stay put, or a futexwake() would look for the waiter
+// under the page's new address.
+int
+futexbusy(uint64 pa)
+{
+  struct futexwaiter *w;
+  int busy = 0;
+
+  for(int i = 0; i < NFUTEX && !busy; i++){
+    acquire(&futex[i].lock);
+    for(w = futex[i].head; w; w = w->next)
+      if(PGROUNDDOWN(w->pa) == pa)
+        busy = 1;
+    release(&futex[i].lock);
+  }
+  return busy;
+}
+
+// Wake at most n threads sleeping on addr.
+// Returns the number woken, or -1 if addr is bad.
+int
+futexwake(uint64 addr, int n)
+{
+  struct futexwaiter *w, **pw;
+  uint64 pa;
+  int h, woken = 0;
+
+  if((pa = futexaddr(addr)) == 0)
+    return -1;
+  h = FUTEXHASH(pa);
+
+  acquire(&futex[h].lock);
+  for(pw = &futex[h].head; (w = *pw) != 0 && woken < n; ){
+    if(w->pa != pa){
+      pw = &w->next;
+      continue;
+    }
+    *pw = w->next;
+    wakeproc(w->p, w);
+    w->p = 0;
+    woken++;
+  }
+  release(&futex[h].lock);
+
+  return woken;
+}
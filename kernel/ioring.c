@@ -0,0 +1,347 @@
+// Asynchronous I/O rings.
+//
+// ioring_setup() maps a page that the process shares with the
+// kernel, holding a ring of submissions and a ring of completions
+// (see ioring.h). The process fills in submissions and calls
+// ioring_enter(), which hands them to a pool of NIOWORKER kernel
+// processes. A worker takes one submission at a time, joins the
+// submitter's thread group to do it (see tgjoin() in proc.c), so
+// that it works with the group's open files and memory, and posts
+// the result as a completion. So up to NIOWORKER of a process's
+// requests can be waiting for the disk at once, while the process
+// itself goes on running.
+//
+// The kernel keeps its own copies of the indices it advances, and
+// copies each submission out of the shared page before looking at
+// it, so a process that scribbles on the page harms only itself.
+// A worker takes a submission only if the completion ring has room
+// for its result.
+//
+// Reads and writes must be of inode files: a worker stuck on an
+// empty pipe would keep the group's files open for ever.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "uio.h"
+#include "ioring.h"
+#include "defs.h"
+
+struct ioctx {
+  struct tgroup *tg;     // owner; 0 if free
+  struct ioring *ring;   // the shared page
+  struct inode *cwd;     // for IO_OPEN; the creator's
+  uint sqhead;           // submissions taken
+  uint sqtail;           // submissions ioring_enter() has seen
+  uint cqtail;           // completions posted
+  int busy;              // submissions being done
+  uint64 rbytes;         // read and written for the group, not
+  uint64 wbytes;         // yet charged to a process's rusage
+};
+
+struct {
+  struct spinlock lock;
+  struct ioctx ctx[NIORING];
+} iorings;
+
+static void ioworker(void);
+
+void
+ioringinit(void)
+{
+  initlock(&iorings.lock, "ioring");
+}
+
+// Start the workers; called once there is a first process.
+void
+ioringstart(void)
+{
+  for(int i = 0; i < NIOWORKER; i++)
+    kproc(ioworker, "iowork");
+}
+
+// Give the current process an I/O ring, mapped at the top of its
+// memory as sbrk() would. Returns its address, or -1.
+uint64
+ioringsetup(void)
+{
+  struct proc *p = myproc();
+  struct ioctx *c, *free = 0;
+  char *page;
+  uint64 va;
+  int ok;
+
+  if((page = kalloc()) == 0)
+    return -1;
+  memset(page, 0, PGSIZE);
+
+  acquire(&iorings.lock);
+  for(c = iorings.ctx; c < &iorings.ctx[NIORING]; c++){
+    if(c->tg == p->tg)
+      break;
+    if(c->tg == 0 && free == 0)
+      free = c;
+  }
+  if(c < &iorings.ctx[NIORING] || free == 0){
+    release(&iorings.lock);
+    kfree(page);
+    return -1;
+  }
+  c = free;
+  c->tg = p->tg;
+  c->ring = (struct ioring*)page;
+  c->cwd = idup(p->cwd);
+  c->sqhead = c->sqtail = c->cqtail = 0;
+  c->busy = 0;
+  c->rbytes = c->wbytes = 0;
+  release(&iorings.lock);
+
+  // the mapping has a reference to the page of its own.
+  acquire(&p->tg->lock);
+  va = PGROUNDUP(p->sz);
+  ok = (va + PGSIZE <= PLIC &&
+        mappages(p->pagetable, va, PGSIZE, (uint64)page,
+                 PTE_R|PTE_W|PTE_U|PTE_SHARED) == 0);
+  if(ok){
+    kdup(page);
+    kvmsync(p->kpagetable, p->pagetable);
+    tgsetsz(p, va + PGSIZE);
+  }
+  release(&p->tg->lock);
+  if(!ok){
+    ioringexit(p->tg);
+    return -1;
+  }
+  return va;
+}
+
+// Hand the submissions the current process has added to its ring
+// to the workers, and wait until at least wait completions are
+// ready, or nothing is left to do. Returns the number of
+// completions ready, or -1.
+int
+ioringenter(int wait)
+{
+  struct proc *p = myproc();
+  struct ioctx *c;
+  struct ioring *r;
+  uint tail;
+  int n;
+
+  acquire(&iorings.lock);
+  for(c = iorings.ctx; c < &iorings.ctx[NIORING]; c++)
+    if(c->tg == p->tg)
+      break;
+  if(c == &iorings.ctx[NIORING]){
+    release(&iorings.lock);
+    return -1;
+  }
+  r = c->ring;
+  tail = __atomic_load_n(&r->sqtail, __ATOMIC_ACQUIRE);
+  if(tail - c->sqhead > IORING_ENTRIES){
+    release(&iorings.lock);
+    return -1;
+  }
+  if(tail != c->sqtail){
+    c->sqtail = tail;
+    wakeup(&iorings);
+  }
+  for(;;){
+    n = c->cqtail - __atomic_load_n(&r->cqhead, __ATOMIC_ACQUIRE);
+    if(n > IORING_ENTRIES)
+      n = -1;
+    if(n < 0 || n >= wait || (c->sqhead == c->sqtail && c->busy == 0))
+      break;
+    if(p->killed){
+      n = -1;
+      break;
+    }
+    sleep(c, &iorings.lock);
+  }
+  // the workers' reads and writes count as the caller's.
+  p->ru.rbytes += c->rbytes;
+  p->ru.wbytes += c->wbytes;
+  c->rbytes = c->wbytes = 0;
+  release(&iorings.lock);
+  return n;
+}
+
+// tg's address space is going away: free its ring, once the
+// workers are done with it.
+void
+ioringexit(struct tgroup *tg)
+{
+  struct ioctx *c;
+  struct ioring *ring = 0;
+  struct inode *cwd = 0;
+
+  acquire(&iorings.lock);
+  for(c = iorings.ctx; c < &iorings.ctx[NIORING]; c++){
+    if(c->tg == tg){
+      while(c->busy)
+        sleep(c, &iorings.lock);
+      ring = c->ring;
+      cwd = c->cwd;
+      c->tg = 0;
+      break;
+    }
+  }
+  release(&iorings.lock);
+  if(ring){
+    kfree(ring);
+    begin_op();
+    iput(cwd);
+    end_op();
+  }
+}
+
+// Find a ring with a submission to take, and room for its result.
+// Caller must hold iorings.lock.
+static struct ioctx *
+iopick(void)
+{
+  struct ioctx *c;
+  uint used;
+
+  for(c = iorings.ctx; c < &iorings.ctx[NIORING]; c++){
+    if(c->tg == 0 || c->sqhead == c->sqtail)
+      continue;
+    used = c->cqtail - __atomic_load_n(&c->ring->cqhead, __ATOMIC_ACQUIRE);
+    if(used <= IORING_ENTRIES && used + c->busy < IORING_ENTRIES)
+      return c;
+  }
+  return 0;
+}
+
+// A reference to the inode file open as fd in the current
+// process, or 0; the caller must fileclose() it. Holding the
+// reference keeps a concurrent close from freeing the file.
+static struct file *
+iofile(int fd)
+{
+  struct file *f;
+
+  if((f = fdget(fd)) == 0)
+    return 0;
+  if(f->type != FD_INODE){
+    fileclose(f);
+    return 0;
+  }
+  return f;
+}
+
+// Do submission s as a member of the submitter's group.
+// Returns what the equivalent system call would.
+static int
+iodo(struct iosqe *s)
+{
+  char path[MAXPATH];
+  struct iovec iov;
+  struct file *f;
+  int r;
+
+  switch(s->op){
+  case IO_NOP:
+    return 0;
+  case IO_READ:
+  case IO_WRITE:
+    if(s->off < -1 || (f = iofile(s->fd)) == 0)
+      return -1;
+    iov.base = (void*)s->addr;
+    iov.len = s->len;
+    if(s->op == IO_READ)
+      r = filereadv(f, &iov, 1, s->off);
+    else
+      r = filewritev(f, &iov, 1, s->off);
+    fileclose(f);
+    return r;
+  case IO_OPEN:
+    if(copyinstr(myproc()->pagetable, path, s->addr, MAXPATH) < 0)
+      return -1;
+    return fileopen(path, s->len);
+  case IO_CLOSE:
+    return fdclose(s->fd);
+  case IO_FSYNC:
+    // the log commits as soon as no file system operation
+    // is in progress, and there is no way to wait for that;
+    // so this can only check fd.
+    if((f = iofile(s->fd)) == 0)
+      return -1;
+    fileclose(f);
+    return 0;
+  }
+  return -1;
+}
+
+// A worker's body; ioringstart() starts them.
+static void
+ioworker(void)
+{
+  struct ioctx *c;
+  struct ioring *r;
+  struct iosqe s;
+  struct iocqe *cqe;
+  struct tgvisit v;
+  struct proc *p = myproc();
+  uint64 rbytes, wbytes;
+  int res;
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  acquire(&iorings.lock);
+  for(;;){
+    if((c = iopick()) == 0){
+      sleep(&iorings, &iorings.lock);
+      continue;
+    }
+    // holding iorings.lock keeps c->tg's last member from
+    // getting through ioringexit(), and so keeps c->tg alive.
+    if(tgjoin(c->tg, c->cwd, &v) != 0){
+      // swapd or tgstop() has the group frozen, or its last
+      // member is on its way into ioringexit(); try again soon.
+      release(&iorings.lock);
+      yield();
+      acquire(&iorings.lock);
+      continue;
+    }
+    r = c->ring;
+    s = r->sq[c->sqhead % IORING_ENTRIES];
+    c->sqhead++;
+    __atomic_store_n(&r->sqhead, c->sqhead, __ATOMIC_RELEASE);
+    c->busy++;
+    release(&iorings.lock);
+
+    rbytes = p->ru.rbytes;
+    wbytes = p->ru.wbytes;
+    res = iodo(&s);
+
+    acquire(&iorings.lock);
+    // filereadv() and filewritev() counted the bytes as this
+    // worker's; move them to the ring, for ioringenter().
+    c->rbytes += p->ru.rbytes - rbytes;
+    c->wbytes += p->ru.wbytes - wbytes;
+    p->ru.rbytes = rbytes;
+    p->ru.wbytes = wbytes;
+    cqe = &r->cq[c->cqtail % IORING_ENTRIES];
+    cqe->data = s.data;
+    cqe->res = res;
+    c->cqtail++;
+    __atomic_store_n(&r->cqtail, c->cqtail, __ATOMIC_RELEASE);
+    c->busy--;
+    wakeup(c);
+    release(&iorings.lock);
+
+    // the last member out frees the ring, which
+    // needs iorings.lock.
+    tgleave(&v);
+    acquire(&iorings.lock);
+  }
+}
@@ -0,0 +1,41 @@
+// Asynchronous I/O rings; see ioring.c.
+
+#define IORING_ENTRIES 64
+
+// submission operations
+#define IO_NOP    0
+#define IO_READ   1   // read len bytes at addr from fd, at off, or
+#define IO_WRITE  2   //   at fd's offset if off is -1; likewise write
+#define IO_OPEN   3   // open the path at addr with mode len
+#define IO_CLOSE  4   // close fd
+#define IO_FSYNC  5   // wait until fd's writes are on disk
+
+struct iosqe {
+  int op;
+  int fd;
+  uint64 addr;
+  int len;
+  int off;
+  uint64 data;    // copied to the completion
+};
+
+struct iocqe {
+  uint64 data;
+  int res;        // what the equivalent system call returns
+  int pad;
+};
+
+// The page ioring_setup() maps. The process fills sq[] and
+// advances sqtail, then calls ioring_enter(); the kernel advances
+// sqhead as it takes submissions. The kernel fills cq[] and
+// advances cqtail; the process advances cqhead as it takes
+// completions. Each index counts up; entry i is at
+// i % IORING_ENTRIES.
+struct ioring {
+  uint sqhead;
+  uint sqtail;
+  uint cqhead;
+  uint cqtail;
+  struct iosqe sq[IORING_ENTRIES];
+  struct iocqe cq[IORING_ENTRIES];
+};
@@ -1,12 +1,39 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// The top NMEGAPAGE*2 MiB of RAM is kept as a pool of
+// physically contiguous, aligned megapages for user memory
+// (see uvmalloc()). Once the page lists run dry, kalloc()
+// breaks up megapages from the pool into ordinary pages.
+// A megapage broken up, here or by unmapping part of it (see
+// uvmunmap()), stays broken up: its pages come back to kfree()
+// one at a time, and are not put together again.
+//
+// A page can have more than one user: read-only program text
+// is shared by the text cache and every address space mapping
+// it. kdup() adds a user, and kfree() frees the page only when
+// the last one lets go.
+//
+// Caches of kalloc()ed pages register a shrinker, a function
+// that frees some of their cold pages. When free memory falls
+// below the low mark, kalloc() has the clock interrupt wake
+// swapd, which runs the shrinkers and then swaps out user pages
+// until free memory is back above the high mark; see swap.c.
+// The marks are NCPU*KMEMLOW and NCPU*KMEMHIGH pages, counted
+// over all the lists and the megapage pool together, not per
+// list. If the lists run dry, kalloc() fails; callers that can
+// wait, like growproc() and vmfault(), wait for swapd with
+// swapwait() and try again. Only swapd runs the shrinkers: kalloc()
+// can't, since its callers may hold locks, like p->lock, that a
+// shrinker's cache lock is taken before.
 
 #include "types.h"
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "kstat.h"
 #include "defs.h"
 
 void freerange(void *pa_start, void *pa_end);
@@ -23,8 +50,37 @@ struct
 {
   struct spinlock lock;
   struct run *freelist;
+  int nfree;          // pages on freelist
 } kmem[NCPU];
 
+// first address of the megapage pool.
+#define MEGABASE (PHYSTOP - NMEGAPAGE * MEGAPGSIZE)
+
+struct
+{
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;          // megapages on freelist
+} kmega;
+
+#define NSHRINKER 4
+
+// registered during boot, so read without a lock.
+static struct
+{
+  char *name;
+  int (*scan)(int);
+} shrinkers[NSHRINKER];
+static int nshrinker;
+
+// set when free memory falls below the low mark;
+// see kmemlow().
+static int kmemwant;
+
+// users of each page beyond the first; 0 for most pages.
+static int kref[(PHYSTOP - KERNBASE) / PGSIZE];
+#define KREF(pa) kref[((uint64)(pa) - KERNBASE) / PGSIZE]
+
 void kinit()
 {
   char p[7] = "kmem_ ";
@@ -32,8 +88,12 @@ void kinit()
   {
     p[5] = '0' + i;
     initlock(&kmem[i].lock, p);
+    lockmode(&kmem[i].lock, LK_TTAS);
   }
-  freerange(end, (void *)PHYSTOP); // 初始将所有物理内存分配给一个CPU
+  initlock(&kmega.lock, "kmega");
+  for (uint64 pa = MEGABASE; pa < PHYSTOP; pa += MEGAPGSIZE)
+    kfreemega((void *)pa);
+  freerange(end, (void *)MEGABASE); // 初始将所有物理内存分配给一个CPU
   // initlock(&kmem.lock, "kmem");
   // freerange(end, (void *)PHYSTOP);
 }
@@ -57,6 +117,17 @@ void kfree(void *pa)
   if (((uint64)pa % PGSIZE) != 0 || (char *)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  // Only drop a reference if the page has other users.
+  for (;;)
+  {
+    int n = KREF(pa);
+    if (n == 0)
+      break;
+    if (__sync_bool_compare_and_swap(&KREF(pa), n, n - 1))
+      return;
+  }
+
+  kstat(KS_KFREE, (uint64)pa);
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
@@ -68,16 +139,52 @@ void kfree(void *pa)
   acquire(&kmem[id].lock);
   r->next = kmem[id].freelist;
   kmem[id].freelist = r;
+  kmem[id].nfree++;
   release(&kmem[id].lock);
 
   pop_off(); // 开中断
 }
 
-// Allocate one 4096-byte page of physical memory.
-// Returns a pointer that the kernel can use.
-// Returns 0 if the memory cannot be allocated.
-void *
-kalloc(void)
+// Add a user to page pa, which kalloc() returned;
+// it is freed once kfree() has been called for each user.
+void kdup(void *pa)
+{
+  if (((uint64)pa % PGSIZE) != 0 || (char *)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  __sync_fetch_and_add(&KREF(pa), 1);
+}
+
+// The number of users of page pa.
+int krefs(void *pa)
+{
+  return KREF(pa) + 1;
+}
+
+// Break a free megapage into pages on CPU id's free list,
+// and return one of them. Returns 0 if the pool is empty.
+// Caller must hold kmem[id].lock.
+static struct run *
+splitmega(int id)
+{
+  struct run *m, *r;
+
+  if ((m = kallocmega()) == 0)
+    return 0;
+
+  for (char *p = (char *)m + PGSIZE; p < (char *)m + MEGAPGSIZE; p += PGSIZE)
+  {
+    r = (struct run *)p;
+    r->next = kmem[id].freelist;
+    kmem[id].freelist = r;
+  }
+  kmem[id].nfree += MEGAPGSIZE / PGSIZE - 1;
+  return m;
+}
+
+// Take a page off this CPU's free list, or another's,
+// or out of the megapage pool. Returns 0 if there is none.
+static struct run *
+kget(void)
 {
   struct run *r;
 
@@ -87,7 +194,10 @@ kalloc(void)
   acquire(&kmem[id].lock);
   r = kmem[id].freelist;
   if (r)
+  {
     kmem[id].freelist = r->next;
+    kmem[id].nfree--;
+  }
   else
   {
     for (int i = 0; i < NCPU; i++)
@@ -99,6 +209,7 @@ kalloc(void)
       {
         r = kmem[i].freelist;
         kmem[i].freelist = r->next; // r未变
+        kmem[i].nfree--;
         release(&kmem[i].lock);
         break;
       }
@@ -107,12 +218,112 @@ kalloc(void)
     // 下次再次进入该CPU时，当前进程仍然没有空闲
     // if (r)
     //   kmem[id].freelist = r->next; // 如果更改指针，则两个CPU将会共用一个freelist，违背了初始目的
+    if (r == 0)
+      r = splitmega(id);
   }
   release(&kmem[id].lock);
 
   pop_off(); // 开中断
+  return r;
+}
+
+// Allocate one 4096-byte page of physical memory.
+// Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc(void)
+{
+  struct run *r;
+
+  r = kget();
+  if (kfreepages() < NCPU * KMEMLOW)
+    kmemwant = 1;
 
   if (r)
+  {
+    kstat(KS_KALLOC, (uint64)r);
     memset((char *)r, 5, PGSIZE); // fill with junk
+  }
+  return (void *)r;
+}
+
+// The number of free pages, counting those in free megapages.
+// Only a snapshot: the lists are not locked.
+int kfreepages(void)
+{
+  int n = kmega.nfree * (MEGAPGSIZE / PGSIZE);
+
+  for (int i = 0; i < NCPU; i++)
+    n += kmem[i].nfree;
+  return n;
+}
+
+// Has free memory fallen below the low mark since the last
+// call? The clock interrupt asks, and wakes swapd if so.
+int kmemlow(void)
+{
+  if (kmemwant == 0)
+    return 0;
+  kmemwant = 0;
+  return 1;
+}
+
+// Register scan as the shrinker of a cache called name.
+// scan(n) should free up to n of the cache's pages that
+// no one is using, and return the number it freed. swapd
+// calls it, holding no locks; it must not allocate.
+// Called during boot.
+void kshrinker(char *name, int (*scan)(int))
+{
+  if (nshrinker == NSHRINKER)
+    panic("kshrinker");
+  shrinkers[nshrinker].name = name;
+  shrinkers[nshrinker].scan = scan;
+  nshrinker++;
+}
+
+// Ask the caches to give back up to n pages between them.
+// Returns the number freed.
+int kshrink(int n)
+{
+  int freed = 0;
+
+  for (int i = 0; i < nshrinker && freed < n; i++)
+    freed += shrinkers[i].scan(n - freed);
+  return freed;
+}
+
+// Free a megapage returned by kallocmega().
+void kfreemega(void *pa)
+{
+  struct run *r;
+
+  if (((uint64)pa % MEGAPGSIZE) != 0 || (char *)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kfreemega");
+
+  r = (struct run *)pa;
+  acquire(&kmega.lock);
+  r->next = kmega.freelist;
+  kmega.freelist = r;
+  kmega.nfree++;
+  release(&kmega.lock);
+}
+
+// Allocate one physically contiguous, MEGAPGSIZE-aligned
+// megapage. Returns 0 if none is free. Unlike kalloc(), does
+// not fill the memory with junk; callers overwrite it anyway.
+void *
+kallocmega(void)
+{
+  struct run *r;
+
+  acquire(&kmega.lock);
+  r = kmega.freelist;
+  if (r)
+  {
+    kmega.freelist = r->next;
+    kmega.nfree--;
+  }
+  release(&kmega.lock);
   return (void *)r;
 }
@@ -0,0 +1,225 @@
+// Kernel counters and event trace.
+//
+// kstat(id, arg) counts an event in counter id: a system call,
+// a page fault, a disk read, and so on (see kstat.h). Each CPU
+// has its own row of counters, so counting takes one atomic add
+// to a cache line that no other CPU writes; reading sums the
+// rows, without a lock.
+//
+// Writing commands to the statistics device controls them:
+//   reset prefix      start the counters named prefix... from 0
+//   trace prefix      also record their events in the trace
+//   untrace prefix    stop that
+//   rcutest           check that RCU works (see rcutest())
+// An empty prefix names every counter. The device's report lists
+// the counters (see statskstat()); reading the trace device
+// returns the traced events, oldest first, as struct kevents. The
+// trace is a ring of NKEVENT events: if readers fall behind, the
+// oldest are lost.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "kstat.h"
+#include "defs.h"
+
+#define NKEVENT 1024
+
+static uint64 kstats[NCPU][NKSTAT] __attribute__((aligned(64)));
+static uint64 kstatbase[NKSTAT];    // sums when last reset
+static uint64 tracemask[(NKSTAT + 63) / 64];
+
+static char *names[KS_SYSCALL] = {
+[KS_PGFAULT]    "pgfault",
+[KS_CSWITCH]    "cswitch",
+[KS_KALLOC]     "kalloc",
+[KS_KFREE]      "kfree",
+[KS_BHIT]       "bcache.hit",
+[KS_BMISS]      "bcache.miss",
+[KS_DISKREAD]   "disk.read",
+[KS_DISKWRITE]  "disk.write",
+[KS_COMMIT]     "log.commit",
+[KS_PCSHRINK]   "pcache.shrink",
+};
+
+static struct {
+  struct spinlock lock;   // readers only
+  struct kevent ev[NKEVENT];
+  uint64 seq[NKEVENT];    // 1 + the event number, once written
+  uint64 head;            // events recorded
+  uint64 tail;            // events read
+} trace;
+
+void
+kstatinit(void)
+{
+  initlock(&trace.lock, "ktrace");
+  devsw[TRACE].read = ktraceread;
+}
+
+// Counter id's name, written to buf, or 0 if it has none.
+static char *
+kstatname(int id, char *buf, int sz)
+{
+  char *s;
+
+  if(id < KS_SYSCALL)
+    return names[id];
+  if((s = syscallname(id - KS_SYSCALL)) == 0)
+    return 0;
+  snprintf(buf, sz, "sys.%s", s);
+  return buf;
+}
+
+static void
+ktraceadd(int id, uint64 arg)
+{
+  uint64 n = __sync_fetch_and_add(&trace.head, 1);
+  struct kevent *e = &trace.ev[n % NKEVENT];
+  struct proc *p;
+
+  // a reader that finds seq changed mid-copy drops the event.
+  __atomic_store_n(&trace.seq[n % NKEVENT], 0, __ATOMIC_RELAXED);
+  __sync_synchronize();
+  push_off();
+  p = myproc();
+  e->time = r_time();
+  e->arg = arg;
+  e->id = id;
+  e->cpu = cpuid();
+  e->pid = p ? p->pid : 0;
+  pop_off();
+  __atomic_store_n(&trace.seq[n % NKEVENT], n + 1, __ATOMIC_RELEASE);
+}
+
+void
+kstat(int id, uint64 arg)
+{
+  // a process may move to another CPU after r_tp(), but the
+  // add is atomic, so that costs nothing but a shared line.
+  __sync_fetch_and_add(&kstats[r_tp()][id], 1);
+  if(tracemask[id / 64] & (1L << (id % 64)))
+    ktraceadd(id, arg);
+}
+
+static uint64
+kstatsum(int id)
+{
+  uint64 n = 0;
+
+  for(int i = 0; i < NCPU; i++)
+    n += __atomic_load_n(&kstats[i][id], __ATOMIC_RELAXED);
+  return n;
+}
+
+// Carry out a command written to the statistics device.
+// Returns 0, or -1 if it is not one.
+int
+kstatctl(char *cmd)
+{
+  char buf[32], *prefix, *name;
+  int op, id, n;
+
+  if(strncmp(cmd, "rcutest", 7) == 0)
+    return rcutest();
+  if(strncmp(cmd, "reset", 5) == 0)
+    op = 0;
+  else if(strncmp(cmd, "trace", 5) == 0)
+    op = 1;
+  else if(strncmp(cmd, "untrace", 7) == 0)
+    op = 2;
+  else
+    return -1;
+  for(prefix = cmd; *prefix && *prefix != ' '; prefix++)
+    ;
+  while(*prefix == ' ')
+    prefix++;
+  n = strlen(prefix);
+  while(n > 0 && (prefix[n-1] == '\n' || prefix[n-1] == ' '))
+    prefix[--n] = 0;
+
+  for(id = 0; id < NKSTAT; id++){
+    if((name = kstatname(id, buf, sizeof(buf))) == 0 || strncmp(name, prefix, n) != 0)
+      continue;
+    if(op == 0)
+      kstatbase[id] = kstatsum(id);
+    else if(op == 1)
+      __sync_fetch_and_or(&tracemask[id / 64], 1L << (id % 64));
+    else
+      __sync_fetch_and_and(&tracemask[id / 64], ~(1L << (id % 64)));
+  }
+  return 0;
+}
+
+// The statistics device's report of the counters: a line with
+// the id, name, count since the last reset, and a '*' if traced.
+int
+statskstat(char *buf, int sz)
+{
+  char nbuf[32], *name;
+  int n = 0;
+
+  n += snprintf(buf + n, sz - n, "--- counters\n");
+  for(int id = 0; id < NKSTAT; id++){
+    if((name = kstatname(id, nbuf, sizeof(nbuf))) == 0)
+      continue;
+    n += snprintf(buf + n, sz - n, "%d %s %d%s\n", id, name,
+                  (int)(kstatsum(id) - kstatbase[id]),
+                  (tracemask[id / 64] & (1L << (id % 64))) ? " *" : "");
+  }
+  return n;
+}
+
+// The trace device's read: copy out whole events from the
+// oldest not yet read, as many as fit in n bytes. Returns -1 if
+// dst is bad.
+int
+ktraceread(int user_dst, uint64 dst, int n)
+{
+  struct kevent e;
+  uint64 head, i;
+  int tot = 0;
+
+  // fault the destination in first, so that copying out under
+  // trace.lock rarely has to let go of it; vmretry() covers the
+  // rest. An event can straddle a page boundary, so try both ends.
+  if(user_dst)
+    vmtouch(dst, n, PTE_W);
+  acquire(&trace.lock);
+  while(tot + sizeof(e) <= n){
+    head = __atomic_load_n(&trace.head, __ATOMIC_ACQUIRE);
+    if(head - trace.tail > NKEVENT)
+      trace.tail = head - NKEVENT;
+    if(trace.tail >= head)
+      break;
+    i = trace.tail % NKEVENT;
+    if(__atomic_load_n(&trace.seq[i], __ATOMIC_ACQUIRE) != trace.tail + 1){
+      trace.tail++;   // being written, or already overwritten
+      continue;
+    }
+    e = trace.ev[i];
+    if(__atomic_load_n(&trace.seq[i], __ATOMIC_ACQUIRE) != trace.tail + 1){
+      trace.tail++;
+      continue;
+    }
+    if(either_copyout(user_dst, dst + tot, &e, sizeof(e)) < 0){
+      if(user_dst && (vmretry(dst + tot, PTE_W, &trace.lock) == 0 ||
+                      vmretry(dst + tot + sizeof(e) - 1, PTE_W, &trace.lock) == 0))
+        continue;   // lock was let go: look at the ring again
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    trace.tail++;
+    tot += sizeof(e);
+  }
+  release(&trace.lock);
+  return tot;
+}
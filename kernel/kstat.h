@@ -0,0 +1,24 @@
+// Kernel counters and event trace; see kstat.c.
+
+// counters
+#define KS_PGFAULT    0   // page faults vmfault() handled
+#define KS_CSWITCH    1   // context switches
+#define KS_KALLOC     2   // pages kalloc() handed out
+#define KS_KFREE      3   // pages kfree() freed
+#define KS_BHIT       4   // bget() found the block cached
+#define KS_BMISS      5   // and didn't
+#define KS_DISKREAD   6   // disk reads
+#define KS_DISKWRITE  7   // disk writes
+#define KS_COMMIT     8   // log transactions committed
+#define KS_PCSHRINK   9   // text cache pages given back to kalloc()
+#define KS_SYSCALL    16  // KS_SYSCALL+n: system call n
+#define NKSTAT        (KS_SYSCALL + 64)
+
+// An event in the trace, as reading the trace device returns it.
+struct kevent {
+  uint64 time;   // time register
+  uint64 arg;    // depends on id
+  ushort id;     // counter that counted it
+  ushort cpu;
+  uint pid;      // 0 if no process
+};
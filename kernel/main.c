@@ -15,6 +15,9 @@ main()
 #if defined(LAB_PGTBL) || defined(LAB_LOCK)
     statsinit();
 #endif
+    kstatinit();
+    profinit();
+    systraceinit();
     printfinit();
     printf("\n");
     printf("xv6 kernel is booting\n");
@@ -22,20 +25,32 @@ main()
     kinit();         // physical page allocator
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
+    asidinit();      // address-space identifiers
     procinit();      // process table
     trapinit();      // trap vectors
+    timersinit();    // sleep timers
     trapinithart();  // install kernel trap vector
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode cache
     fileinit();      // file table
+    pollinit();      // poll() queues
+    pcacheinit();    // program text cache
+    swapinit();      // swap area
+    shminit();       // shared memory segments
+    ioringinit();    // asynchronous I/O rings
+    futexinit();     // user thread wait/wake
+    rcuinit();       // read-copy-update
     virtio_disk_init(); // emulated hard disk
 #ifdef LAB_NET
     pci_init();
     sockinit();
 #endif    
     userinit();      // first user process
+    kproc(swapd, "swapd"); // swaps out pages when memory runs low
+    ioringstart();   // I/O ring workers
+    kproc(rcud, "rcud"); // frees what readers may still see, later
     __sync_synchronize();
     started = 1;
   } else {
@@ -26,7 +26,12 @@
 #define VIRTIO0_IRQ 1
 
 // core local interruptor (CLINT), which contains the timer.
+// kernelvec.S includes this file, and as takes no L suffix.
+#ifdef __ASSEMBLER__
+#define CLINT 0x2000000
+#else
 #define CLINT 0x2000000L
+#endif
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -62,6 +67,13 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   ...
+//   TRAPFRAME_THREAD(i) (trapframes of threads sharing the page table)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// a thread created by clone() shares its creator's page table,
+// so its trapframe is mapped at an address of its own, chosen
+// by the thread's index i in the proc table.
+#define TRAPFRAME_THREAD(i) (TRAPFRAME - ((i)+1)*PGSIZE)
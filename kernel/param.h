@@ -4,10 +4,27 @@
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
+#define NSYSLAT      64  // system call numbers timed per process
+#define NSYSHIST     16  // buckets in a system call latency histogram
+#define TICKCYCLES   1000000 // timer cycles a clock tick; about 1/10th second in qemu
+#define TIMEFREQ    10000000 // timer cycles a second, in qemu
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
 #define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
 #define FSSIZE       10000  // size of file system in blocks
+#define SWAPSIZE     32768  // size of swap area after it, in blocks
 #define MAXPATH      128   // maximum file path name
+#define NMEGAPAGE    16    // 2 MiB pages set aside for user megapages
+#define NPCACHE      256   // pages in the program text cache
+#define KMEMLOW      64    // reclaim starts below NCPU*KMEMLOW free pages in all
+#define KMEMHIGH     256   // and stops at NCPU*KMEMHIGH
+#define NSHM         16    // shared memory segments
+#define SHMMAX       (4*1024*1024) // bytes in a shared memory segment
+#define PIPEPAGES    4     // pages in a new pipe's buffer
+#define PIPEMAXPAGES 16    // pages pipesize() may give a pipe's buffer
+#define MAXIOV       16    // buffers in one readv() or writev()
+#define NIORING      8     // processes with an I/O ring
+#define NIOWORKER    4     // kernel processes serving I/O rings
+#define MAXBATCH     64    // system calls in one syscall_batch()
@@ -0,0 +1,215 @@
+// Program text cache.
+//
+// exec() does not read program text into memory; vmfault() in
+// vm.c maps each text page when the process first touches it.
+// The pages come from this cache, keyed by inode and file
+// offset, so that processes running the same program share one
+// read-only copy of each text page, and a program run again soon
+// finds its text still in memory.
+//
+// The cache holds a reference to each page (see kdup() in
+// kalloc.c), as does each page table that maps it. A page that
+// only the cache still holds is the first to go when a slot is
+// needed, or when memory runs short and swapd calls pcacheshrink().
+// Writing or truncating a file drops its pages from the cache;
+// processes already mapping them keep the old contents.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "kstat.h"
+#include "defs.h"
+
+struct cpage {
+  uint dev;
+  uint inum;
+  uint off;        // file offset of the page
+  uint64 pa;       // the page, or 0
+  int busy;        // being read in; others wait
+  int stale;       // file changed during the read
+};
+
+struct {
+  struct spinlock lock;
+  struct cpage page[NPCACHE];
+  int hand;        // where the search for a victim resumes
+} pcache;
+
+static int pcacheshrink(int);
+
+void
+pcacheinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  kshrinker("pcache", pcacheshrink);
+}
+
+// Find the cached or busy page of ip at off.
+// Caller must hold pcache.lock.
+static struct cpage *
+pclookup(struct inode *ip, uint off)
+{
+  struct cpage *c;
+
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++)
+    if((c->pa || c->busy) && c->dev == ip->dev &&
+       c->inum == ip->inum && c->off == off)
+      return c;
+  return 0;
+}
+
+// Find a free slot, evicting a page that no page table maps
+// if there is none. Returns 0 if every page is in use.
+// Caller must hold pcache.lock.
+static struct cpage *
+pcalloc(void)
+{
+  struct cpage *c;
+
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++)
+    if(c->pa == 0 && !c->busy)
+      return c;
+  for(int i = 0; i < NPCACHE; i++){
+    c = &pcache.page[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    if(!c->busy && krefs((void*)c->pa) == 1){
+      kfree((void*)c->pa);
+      c->pa = 0;
+      return c;
+    }
+  }
+  return 0;
+}
+
+// Return a cached page holding n bytes of ip from offset off
+// (which is page-aligned) followed by zeros, or 0 if it isn't
+// cached. The caller gets a reference to the page; kfree()
+// drops it. Does not sleep, so ip may be locked.
+uint64
+pcachelookup(struct inode *ip, uint off)
+{
+  struct cpage *c;
+  uint64 pa = 0;
+
+  acquire(&pcache.lock);
+  c = pclookup(ip, off);
+  if(c && !c->busy){
+    pa = c->pa;
+    kdup((void*)pa);
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Like pcachelookup(), but read the page in from ip if it is
+// not cached. If the cache is full of mapped pages, returns a
+// page of the caller's own. Returns 0 if out of memory or the
+// read fails, or if the caller holds ip locked: a write from
+// the program's own text to its file faults here from inside
+// writei(), and must let go of ip before the page can be read.
+uint64
+pcacheget(struct inode *ip, uint off, uint n)
+{
+  struct cpage *c;
+  char *mem;
+
+  if(holdingrwsleep(&ip->lock, 0))
+    return 0;
+
+  acquire(&pcache.lock);
+  while((c = pclookup(ip, off)) != 0 && c->busy)
+    sleep(c, &pcache.lock);
+  if(c){
+    kdup((void*)c->pa);
+    release(&pcache.lock);
+    return c->pa;
+  }
+  if((c = pcalloc()) != 0){
+    c->dev = ip->dev;
+    c->inum = ip->inum;
+    c->off = off;
+    c->busy = 1;
+    c->stale = 0;
+  }
+  release(&pcache.lock);
+
+  if((mem = kalloc()) != 0){
+    memset(mem, 0, PGSIZE);
+    ilockshared(ip);
+    // set while holding ip, so that a writer, which holds it
+    // exclusively, sees it and marks c stale.
+    if(c)
+      ip->cachedtext = 1;
+    if(readi(ip, 0, (uint64)mem, off, n) != n){
+      kfree(mem);
+      mem = 0;
+    }
+    iunlock(ip);
+  }
+
+  if(c == 0)
+    return (uint64)mem;
+  acquire(&pcache.lock);
+  c->busy = 0;
+  if(mem && !c->stale){
+    c->pa = (uint64)mem;
+    kdup(mem);
+  }
+  wakeup(c);
+  release(&pcache.lock);
+  return (uint64)mem;
+}
+
+// kalloc()'s shrinker: free up to n cached pages that no page
+// table maps, in the order pcalloc() would evict them.
+// Returns the number freed.
+static int
+pcacheshrink(int n)
+{
+  struct cpage *c;
+  int freed = 0;
+
+  acquire(&pcache.lock);
+  for(int i = 0; i < NPCACHE && freed < n; i++){
+    c = &pcache.page[pcache.hand];
+    pcache.hand = (pcache.hand + 1) % NPCACHE;
+    if(c->pa && !c->busy && krefs((void*)c->pa) == 1){
+      kstat(KS_PCSHRINK, c->pa);
+      kfree((void*)c->pa);
+      c->pa = 0;
+      freed++;
+    }
+  }
+  release(&pcache.lock);
+  return freed;
+}
+
+// ip's contents are changing: forget its cached pages.
+// Caller must hold ip locked, exclusively.
+void
+pcacheinval(struct inode *ip)
+{
+  struct cpage *c;
+
+  // most files written were never run.
+  if(!ip->cachedtext)
+    return;
+  acquire(&pcache.lock);
+  for(c = pcache.page; c < &pcache.page[NPCACHE]; c++){
+    if(c->dev != ip->dev || c->inum != ip->inum)
+      continue;
+    if(c->busy)
+      c->stale = 1;
+    else if(c->pa){
+      kfree((void*)c->pa);
+      c->pa = 0;
+    }
+  }
+  ip->cachedtext = 0;
+  release(&pcache.lock);
+}
@@ -3,22 +3,83 @@
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+// A pipe's buffer is a ring of pages: PIPEPAGES of them, unless
+// pipesize() changes that. The ring holds the bytes from count
+// nread up to count nwrite, each at its count modulo the ring's
+// size, which is a power of two so that the counts may wrap.
+// piperead() and pipewrite() copy as much at a time as is
+// contiguous both in the ring and in the user page.
+//
+// filesplice() in file.c moves data between a pipe and a file
+// without a trip through user memory. It reserves a span of the
+// ring with pipereadspan() or pipewritespan(), does the file I/O
+// straight to or from the span without pi->lock, since the I/O
+// may sleep, and then hands the span back with pipereaddone() or
+// pipewritedone(). rbusy or wbusy keeps other readers or writers
+// away from the ring meanwhile.
+
+#define PIPEMAX (PIPEMAXPAGES*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEMAXPAGES];  // the ring
+  uint size;      // bytes in the ring
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rbusy;      // a reserved span is being read
+  int wbusy;      // a reserved span is being written
+  struct pollq pollq;
 };
 
+static void
+ringfree(char **page, int npages)
+{
+  for(int i = 0; i < npages; i++)
+    kfree(page[i]);
+}
+
+// Allocate the pages of a ring. Returns -1 if out of memory.
+static int
+ringalloc(char **page, int npages)
+{
+  for(int i = 0; i < npages; i++){
+    if((page[i] = kalloc()) == 0){
+      ringfree(page, i);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// The byte for count n in pi's ring.
+static char*
+ringaddr(struct pipe *pi, uint n)
+{
+  n %= pi->size;
+  return pi->page[n / PGSIZE] + n % PGSIZE;
+}
+
+// How much of max bytes, from count n in a ring and from
+// address va, lies within one page of each.
+static uint
+span(uint n, uint64 va, uint max)
+{
+  if(max > PGSIZE - n % PGSIZE)
+    max = PGSIZE - n % PGSIZE;
+  if(max > PGSIZE - va % PGSIZE)
+    max = PGSIZE - va % PGSIZE;
+  return max;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,10 +91,17 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  pi->size = 0;
+  if(ringalloc(pi->page, PIPEPAGES) < 0)
+    goto bad;
+  pi->size = PIPEPAGES*PGSIZE;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->rbusy = 0;
+  pi->wbusy = 0;
+  pi->pollq.head = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -66,11 +134,13 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwakeup(&pi->pollq);
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
 #ifdef LAB_LOCK
     freelock(&pi->lock);
 #endif    
+    ringfree(pi->page, pi->size / PGSIZE);
     kfree((char*)pi);
   } else
     release(&pi->lock);
@@ -79,25 +149,36 @@ pipeclose(struct pipe *pi, int writable)
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i;
-  char ch;
+  int i = 0;
+  uint m;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
-  for(i = 0; i < n; i++){
-    while(pi->nwrite == pi->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(pi->readopen == 0 || pr->killed){
-        release(&pi->lock);
-        return -1;
-      }
+  while(i < n){
+    if(pi->readopen == 0 || pr->killed){
+      release(&pi->lock);
+      return -1;
+    }
+    if(pi->wbusy || pi->nwrite == pi->nread + pi->size){  //DOC: pipewrite-full
       wakeup(&pi->nread);
+      pollwakeup(&pi->pollq);
       sleep(&pi->nwrite, &pi->lock);
+      continue;
     }
-    if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+    m = pi->nread + pi->size - pi->nwrite;
+    if(m > n - i)
+      m = n - i;
+    m = span(pi->nwrite, addr + i, m);
+    if(copyin(pr->pagetable, ringaddr(pi, pi->nwrite), addr + i, m) == -1){
+      if(vmretry(addr + i, PTE_R, &pi->lock) == 0)
+        continue;
       break;
-    pi->data[pi->nwrite++ % PIPESIZE] = ch;
+    }
+    pi->nwrite += m;
+    i += m;
   }
   wakeup(&pi->nread);
+  pollwakeup(&pi->pollq);
   release(&pi->lock);
   return i;
 }
@@ -106,25 +187,207 @@ int
 piperead(struct pipe *pi, uint64 addr, int n)
 {
   int i;
+  uint m;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->rbusy){  //DOC: pipe-empty
     if(pr->killed){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
+  for(i = 0; i < n; ){  //DOC: piperead-copy
+    if(pi->nread == pi->nwrite || pi->rbusy)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    m = pi->nwrite - pi->nread;
+    if(m > n - i)
+      m = n - i;
+    m = span(pi->nread, addr + i, m);
+    if(copyout(pr->pagetable, addr + i, ringaddr(pi, pi->nread), m) == -1){
+      if(vmretry(addr + i, PTE_W, &pi->lock) == 0)
+        continue;
       break;
+    }
+    pi->nread += m;
+    i += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  pollwakeup(&pi->pollq);
   release(&pi->lock);
   return i;
 }
+
+// Which of POLLIN, POLLOUT and POLLHUP hold for the read side
+// of pi, or the write side if writable is set. If e is not 0,
+// queue it to be woken when that may change.
+int
+pipepoll(struct pipe *pi, int writable, struct pollent *e)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  if(e)
+    pollqueue(&pi->pollq, e);
+  if(writable){
+    if(pi->readopen == 0)
+      r = POLLHUP;
+    else if(!pi->wbusy && pi->nwrite != pi->nread + pi->size)
+      r = POLLOUT;
+  } else {
+    if(pi->writeopen == 0)
+      r = POLLHUP;
+    if(pi->nread != pi->nwrite && !pi->rbusy)
+      r |= POLLIN;
+  }
+  release(&pi->lock);
+  return r;
+}
+
+// Reserve up to n bytes of the data in pi's ring, as much as is
+// contiguous, for the caller to read without pi->lock, and set
+// *pp to them. If the pipe is empty, waits for data if wait is
+// set. Returns the number of bytes, 0 at end of file or if the
+// pipe is empty, or -1 if killed. After a positive return, the
+// caller must call pipereaddone().
+int
+pipereadspan(struct pipe *pi, int n, int wait, char **pp)
+{
+  struct proc *pr = myproc();
+  uint m;
+
+  acquire(&pi->lock);
+  while(pi->rbusy || (wait && pi->nread == pi->nwrite && pi->writeopen)){
+    if(pr->killed){
+      release(&pi->lock);
+      return -1;
+    }
+    sleep(&pi->nread, &pi->lock);
+  }
+  m = pi->nwrite - pi->nread;
+  if(m > n)
+    m = n;
+  m = span(pi->nread, 0, m);
+  if(m > 0){
+    pi->rbusy = 1;
+    *pp = ringaddr(pi, pi->nread);
+  }
+  release(&pi->lock);
+  return m;
+}
+
+// The caller of pipereadspan() has consumed n bytes of its span.
+void
+pipereaddone(struct pipe *pi, int n)
+{
+  acquire(&pi->lock);
+  pi->nread += n;
+  pi->rbusy = 0;
+  wakeup(&pi->nread);
+  wakeup(&pi->nwrite);
+  pollwakeup(&pi->pollq);
+  release(&pi->lock);
+}
+
+// Reserve up to n bytes (n > 0) of free space in pi's ring, as
+// much as is contiguous, for the caller to fill without pi->lock,
+// and set *pp to it. Waits while the ring is full. Returns the
+// number of bytes, or -1 if the read side is closed or the caller
+// is killed. The caller must then call pipewritedone().
+int
+pipewritespan(struct pipe *pi, int n, char **pp)
+{
+  struct proc *pr = myproc();
+  uint m;
+
+  acquire(&pi->lock);
+  for(;;){
+    if(pi->readopen == 0 || pr->killed){
+      release(&pi->lock);
+      return -1;
+    }
+    if(!pi->wbusy && pi->nwrite != pi->nread + pi->size)
+      break;
+    wakeup(&pi->nread);
+    pollwakeup(&pi->pollq);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  m = pi->nread + pi->size - pi->nwrite;
+  if(m > n)
+    m = n;
+  m = span(pi->nwrite, 0, m);
+  pi->wbusy = 1;
+  *pp = ringaddr(pi, pi->nwrite);
+  release(&pi->lock);
+  return m;
+}
+
+// The caller of pipewritespan() has filled n bytes of its span.
+void
+pipewritedone(struct pipe *pi, int n)
+{
+  acquire(&pi->lock);
+  pi->nwrite += n;
+  pi->wbusy = 0;
+  wakeup(&pi->nread);
+  wakeup(&pi->nwrite);
+  pollwakeup(&pi->pollq);
+  release(&pi->lock);
+}
+
+// Make pi's ring n bytes, rounded up to a power-of-two number
+// of pages, keeping the data in it; or, if n is 0, leave it be.
+// Returns the ring's size, or -1 if n is too big or there is
+// more data in the ring than would fit.
+int
+pipesize(struct pipe *pi, int n)
+{
+  char *page[PIPEMAXPAGES], *old[PIPEMAXPAGES];
+  struct proc *pr = myproc();
+  int npages, oldpages;
+  uint len, m;
+
+  if(n < 0 || n > PIPEMAX)
+    return -1;
+  if(n == 0){
+    acquire(&pi->lock);
+    n = pi->size;
+    release(&pi->lock);
+    return n;
+  }
+  for(npages = 1; npages*PGSIZE < n; npages *= 2)
+    ;
+  if(ringalloc(page, npages) < 0)
+    return -1;
+
+  acquire(&pi->lock);
+  // pipereaddone() and pipewritedone() both wake pi->nread.
+  while(pi->rbusy || pi->wbusy){
+    if(pr->killed)
+      break;
+    sleep(&pi->nread, &pi->lock);
+  }
+  len = pi->nwrite - pi->nread;
+  if(pr->killed || len > npages*PGSIZE){
+    release(&pi->lock);
+    ringfree(page, npages);
+    return -1;
+  }
+  // move the data to the start of the new ring.
+  for(uint i = 0; i < len; i += m){
+    m = span(pi->nread + i, i, len - i);
+    memmove(page[i / PGSIZE] + i % PGSIZE, ringaddr(pi, pi->nread + i), m);
+  }
+  oldpages = pi->size / PGSIZE;
+  memmove(old, pi->page, sizeof(old));
+  memmove(pi->page, page, sizeof(page));
+  pi->size = npages*PGSIZE;
+  pi->nread = 0;
+  pi->nwrite = len;
+  wakeup(&pi->nwrite);
+  pollwakeup(&pi->pollq);
+  release(&pi->lock);
+  ringfree(old, oldpages);
+  return npages*PGSIZE;
+}
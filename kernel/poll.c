@@ -0,0 +1,209 @@
+// poll(): wait until any of several files is ready.
+//
+// Pipes and the console each have a poll queue. A process in
+// poll() puts an entry for itself on the queue of each file it
+// waits for, in the same critical section in which it checks
+// whether the file is ready (see pipepoll() and consolepoll()),
+// and sleeps if none is. Whatever makes a file ready calls
+// pollwakeup() on the file's queue, which wakes every process
+// queued there; polltick(), from the clock interrupt, wakes the
+// ones whose timeout has run out.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "poll.h"
+#include "defs.h"
+
+// a process in poll(); lives on its kernel stack.
+struct poller {
+  int woken;             // something may be ready
+  uint deadline;         // in ticks, if timed
+  struct poller *next;   // on pollers.timed
+};
+
+// a poller's place on one file's poll queue.
+struct pollent {
+  struct pollent *next;
+  struct pollq *q;
+  struct poller *w;
+};
+
+struct {
+  struct spinlock lock;  // protects every poll queue, and the below
+  struct poller *timed;  // pollers with a timeout
+} pollers;
+
+void
+pollinit(void)
+{
+  initlock(&pollers.lock, "poll");
+}
+
+// Put e on q. The caller holds the lock that guards the file's
+// readiness, and must hold it across the check that follows, so
+// a pollwakeup() can't slip in between.
+void
+pollqueue(struct pollq *q, struct pollent *e)
+{
+  acquire(&pollers.lock);
+  e->q = q;
+  e->next = q->head;
+  q->head = e;
+  release(&pollers.lock);
+}
+
+static void
+pollunqueue(struct pollent *e)
+{
+  struct pollent **pp;
+
+  acquire(&pollers.lock);
+  for(pp = &e->q->head; *pp; pp = &(*pp)->next){
+    if(*pp == e){
+      *pp = e->next;
+      break;
+    }
+  }
+  release(&pollers.lock);
+}
+
+// The file that q belongs to may have become ready: wake the
+// processes polling it. The caller holds the lock that it held
+// for pollqueue(), so q->head can be looked at without
+// pollers.lock, making this cheap when no one is polling.
+void
+pollwakeup(struct pollq *q)
+{
+  struct pollent *e;
+
+  if(q->head == 0)
+    return;
+  acquire(&pollers.lock);
+  for(e = q->head; e; e = e->next){
+    e->w->woken = 1;
+    wakeup(e->w);
+  }
+  release(&pollers.lock);
+}
+
+// Wake pollers whose timeout has run out.
+// Called from the clock interrupt.
+void
+polltick(void)
+{
+  struct poller *w;
+  uint now = ticks;
+
+  // a poller that this misses adds itself and then checks
+  // the time itself, so a racy look is enough.
+  if(pollers.timed == 0)
+    return;
+  acquire(&pollers.lock);
+  for(w = pollers.timed; w; w = w->next){
+    if((int)(now - w->deadline) >= 0){
+      w->woken = 1;
+      wakeup(w);
+    }
+  }
+  release(&pollers.lock);
+}
+
+// Wait until one of the nfds files described by the struct
+// pollfds at user address addr is ready, or timeout ticks pass
+// (for ever if timeout < 0). Sets each revents and returns the
+// number of files that are ready, or -1.
+int
+poll(uint64 addr, int nfds, int timeout)
+{
+  struct proc *p = myproc();
+  struct pollfd fds[NOFILE];
+  struct pollent ents[NOFILE];
+  struct file *files[NOFILE];
+  struct poller w, **pp;
+  int i, n, fd, r = -1;
+
+  if(nfds < 0 || nfds > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, addr, nfds*sizeof(fds[0])) < 0)
+    return -1;
+
+  // hold a reference to each file, so that another thread
+  // can't close it while it has this poller queued.
+  for(i = 0; i < nfds; i++){
+    fd = fds[i].fd;
+    ents[i].q = 0;
+    files[i] = fdget(fd);
+  }
+
+  w.woken = 0;
+  w.deadline = 0;
+  if(timeout > 0){
+    acquire(&tickslock);
+    w.deadline = ticks + timeout;
+    release(&tickslock);
+    acquire(&pollers.lock);
+    w.next = pollers.timed;
+    pollers.timed = &w;
+    release(&pollers.lock);
+  }
+
+  for(int pass = 0; ; pass++){
+    acquire(&pollers.lock);
+    w.woken = 0;
+    release(&pollers.lock);
+
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      if(files[i] == 0){
+        fds[i].revents = fds[i].fd >= 0 ? POLLNVAL : 0;
+      } else {
+        ents[i].w = &w;
+        fds[i].revents = filepoll(files[i], pass == 0 ? &ents[i] : 0) &
+          (fds[i].events | POLLHUP);
+      }
+      if(fds[i].revents)
+        n++;
+    }
+    if(n > 0 || timeout == 0 ||
+       (timeout > 0 && (int)(ticks - w.deadline) >= 0)){
+      r = n;
+      break;
+    }
+
+    acquire(&pollers.lock);
+    while(!w.woken && !p->killed)
+      sleep(&w, &pollers.lock);
+    release(&pollers.lock);
+    if(p->killed)
+      break;
+  }
+
+  for(i = 0; i < nfds; i++){
+    if(files[i] == 0)
+      continue;
+    if(ents[i].q)
+      pollunqueue(&ents[i]);
+    fileclose(files[i]);
+  }
+  if(timeout > 0){
+    acquire(&pollers.lock);
+    for(pp = &pollers.timed; *pp; pp = &(*pp)->next){
+      if(*pp == &w){
+        *pp = w.next;
+        break;
+      }
+    }
+    release(&pollers.lock);
+  }
+
+  if(r >= 0 && copyout(p->pagetable, addr, (char*)fds, nfds*sizeof(fds[0])) < 0)
+    r = -1;
+  return r;
+}
@@ -0,0 +1,10 @@
+#define POLLIN    0x1   // read() will not block
+#define POLLOUT   0x4   // write() will not block
+#define POLLHUP   0x10  // the other end of the pipe is closed
+#define POLLNVAL  0x20  // fd is not open
+
+struct pollfd {
+  int fd;
+  short events;   // what to wait for
+  short revents;  // what is ready; POLLHUP and POLLNVAL always count
+};
@@ -13,6 +13,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
+#include "rusage.h"
 #include "proc.h"
 
 volatile int panicked = 0;
@@ -130,5 +131,6 @@ void
 printfinit(void)
 {
   initlock(&pr.lock, "pr");
+  lockmode(&pr.lock, LK_TICKET);
   pr.locking = 1;
 }
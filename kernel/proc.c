@@ -3,7 +3,9 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
+#include "kstat.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
@@ -15,9 +17,17 @@ struct proc *initproc;
 int nextpid = 1;
 struct spinlock pid_lock;
 
+struct tgroup tgroups[NPROC];
+struct spinlock tg_lock;
+
+// kernel processes kproc() has started; they never exit.
+static int nkproc;
+
 extern void forkret(void);
 static void wakeup1(struct proc *chan);
 static void freeproc(struct proc *p);
+static void tgkill(struct proc *p);
+static int waitchild(int thread, int tid, uint64 addr, uint64 ruaddr);
 
 extern char trampoline[]; // trampoline.S
 
@@ -27,6 +37,9 @@ void procinit(void)
   struct proc *p;
 
   initlock(&pid_lock, "nextpid");
+  initlock(&tg_lock, "tgroups");
+  for (struct tgroup *tg = tgroups; tg < &tgroups[NPROC]; tg++)
+    initlock(&tg->lock, "tgroup");
   for (p = proc; p < &proc[NPROC]; p++)
   {
     initlock(&p->lock, "proc");
@@ -86,12 +99,105 @@ int allocpid()
   return pid;
 }
 
+// Thread groups. A process and the threads it creates with
+// clone() share one struct tgroup: the address space, open files
+// and program text. A process's exiting kills the threads in its
+// group too (see tgkill()), and so, since it then exits, does
+// killing it; a thread that is killed or exits takes only itself
+// with it.
+
+// Allocate a thread group with one member and no open files.
+// Returns 0 if all groups are in use.
+static struct tgroup *
+tgalloc(void)
+{
+  struct tgroup *tg;
+
+  acquire(&tg_lock);
+  for (tg = tgroups; tg < &tgroups[NPROC]; tg++)
+  {
+    if (tg->ref == 0)
+    {
+      tg->ref = 1;
+      tg->nlive = 1;
+      memset(tg->ofile, 0, sizeof(tg->ofile));
+      memset(&tg->text, 0, sizeof(tg->text));
+      asidnew(tg);
+      release(&tg_lock);
+      return tg;
+    }
+  }
+  release(&tg_lock);
+  return 0;
+}
+
+// Add a new member to tg.
+static struct tgroup *
+tgdup(struct tgroup *tg)
+{
+  acquire(&tg_lock);
+  tg->ref++;
+  tg->nlive++;
+  release(&tg_lock);
+  return tg;
+}
+
+// Drop a member's reference to the group's address space.
+// Returns the number of members still using it; the group
+// is free for reuse once this reaches zero.
+static int
+tgput(struct tgroup *tg)
+{
+  int ref;
+
+  acquire(&tg_lock);
+  ref = --tg->ref;
+  release(&tg_lock);
+  return ref;
+}
+
+// A member of tg is exiting or leaving the group.
+// The last one out closes the shared open files
+// and lets go of the program file.
+static void
+tgexit(struct tgroup *tg)
+{
+  int last;
+
+  acquire(&tg_lock);
+  last = (--tg->nlive == 0);
+  release(&tg_lock);
+
+  if (!last)
+    return;
+  for (int fd = 0; fd < NOFILE; fd++)
+  {
+    if (tg->ofile[fd])
+    {
+      struct file *f = tg->ofile[fd];
+      fileclose(f);
+      tg->ofile[fd] = 0;
+    }
+  }
+  if (tg->text.ip)
+  {
+    begin_op();
+    iput(tg->text.ip);
+    end_op();
+    tg->text.ip = 0;
+  }
+  ioringexit(tg);
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
+// If share is 0, the new proc gets an empty address space of
+// its own; otherwise it is a thread sharing share's address
+// space and open files.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc *
-allocproc(void)
+allocproc(struct proc *share)
 {
   struct proc *p;
 
@@ -119,13 +225,51 @@ found:
     return 0;
   }
 
-  // An empty user page table.
-  p->pagetable = proc_pagetable(p);
-  if (p->pagetable == 0)
+  if (share == 0)
   {
-    freeproc(p);
-    release(&p->lock);
-    return 0;
+    // An empty user page table, in a group of its own.
+    if ((p->tg = tgalloc()) == 0)
+    {
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    p->trapframeva = TRAPFRAME;
+    p->pagetable = proc_pagetable(p);
+    if (p->pagetable == 0)
+    {
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    p->kpagetable = kvmcreate();
+    if (p->kpagetable == 0)
+    {
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+  }
+  else
+  {
+    // Share the creator's page table, mapping this thread's
+    // trapframe at an address of its own.
+    p->trapframeva = TRAPFRAME_THREAD((int)(p - proc));
+    acquire(&share->tg->lock);
+    if (mappages(share->pagetable, p->trapframeva, PGSIZE,
+                 (uint64)(p->trapframe), PTE_R | PTE_W) < 0)
+    {
+      release(&share->tg->lock);
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    release(&share->tg->lock);
+    p->tg = tgdup(share->tg);
+    p->pagetable = share->pagetable;
+    p->kpagetable = share->kpagetable;
+    p->sz = share->sz;
+    p->thread = 1;
   }
 
   // Set up new context to start executing at forkret,
@@ -143,19 +287,29 @@ found:
 static void
 freeproc(struct proc *p)
 {
+  if (p->pagetable)
+    proc_freevm(p->tg, p->pagetable, p->kpagetable, p->trapframeva, p->sz);
+  else if (p->tg)
+    tgput(p->tg);
   if (p->trapframe)
     kfree((void *)p->trapframe);
   p->trapframe = 0;
-  if (p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  p->kpagetable = 0;
+  p->tg = 0;
+  p->trapframeva = 0;
   p->sz = 0;
   p->pid = 0;
+  p->thread = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->tracemask = 0;
+  memset(p->syslat, 0, sizeof(p->syslat));
+  memset(&p->ru, 0, sizeof(p->ru));
+  memset(&p->cru, 0, sizeof(p->cru));
   p->state = UNUSED;
 }
 
@@ -194,15 +348,258 @@ proc_pagetable(struct proc *p)
   return pagetable;
 }
 
-// Free a process's page table, and free the
-// physical memory it refers to.
-void proc_freepagetable(pagetable_t pagetable, uint64 sz)
+// Free a process's page table, whose trapframe is mapped
+// at trapframeva, and free the physical memory it refers to.
+void proc_freepagetable(pagetable_t pagetable, uint64 trapframeva, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-  uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, trapframeva, 1, 0);
   uvmfree(pagetable, sz);
 }
 
+// Release one thread's use of tg's page tables: unmap the thread's
+// trapframe, and free the page tables and user memory if no other
+// thread still uses them.
+void proc_freevm(struct tgroup *tg, pagetable_t pagetable, pagetable_t kpagetable,
+                 uint64 trapframeva, uint64 sz)
+{
+  if (tgput(tg) == 0)
+  {
+    if (kpagetable)
+      kvmfree(kpagetable);
+    proc_freepagetable(pagetable, trapframeva, sz);
+  }
+  else
+  {
+    acquire(&tg->lock);
+    uvmunmap(pagetable, trapframeva, 1, 0);
+    asidflush(tg);
+    release(&tg->lock);
+  }
+}
+
+// Stop tg's threads from running, so that swapd can take pages
+// from the group's address space (see swap.c). They stay where
+// they are, runnable or asleep, until tgthaw(); the scheduler
+// passes over them meanwhile. Fails if a member is running or
+// has exited. Returns a member, whose pagetable and sz describe
+// the address space, or 0 on failure.
+struct proc *
+tgfreeze(struct tgroup *tg)
+{
+  struct proc *pp, *member = 0;
+  int ok;
+
+  acquire(&tg_lock);
+  ok = (tg->ref > 0 && tg->nlive == tg->ref && !tg->frozen);
+  if (ok)
+    tg->frozen = 1;
+  release(&tg_lock);
+  if (!ok)
+    return 0;
+
+  // the scheduler checks frozen while holding a member's lock,
+  // so a member this loop finds not running stays that way.
+  for (pp = proc; pp < &proc[NPROC]; pp++)
+  {
+    acquire(&pp->lock);
+    if (pp->tg == tg)
+    {
+      if (pp->state != RUNNABLE && pp->state != SLEEPING)
+        ok = 0;
+      member = pp;
+    }
+    release(&pp->lock);
+  }
+  if (!ok || member == 0)
+  {
+    tgthaw(tg);
+    return 0;
+  }
+  return member;
+}
+
+// Let tg's threads run again.
+void tgthaw(struct tgroup *tg)
+{
+  acquire(&tg_lock);
+  tg->frozen = 0;
+  tg->stopper = 0;
+  release(&tg_lock);
+}
+
+// Stop the other threads in p's group from running, so that p can
+// unmap and free pages of the group's address space: a thread
+// running on another hart could still reach them through its TLB.
+// Waits until none of them is running, and keeps them from running
+// until tgthaw(); meanwhile p should flush this hart's TLB before
+// it frees the pages (see uvmunmapsync()), and call asidflush(), so
+// that the other harts flush theirs before they run the group
+// again. p must hold no locks.
+void tgstop(struct proc *p)
+{
+  struct tgroup *tg = p->tg;
+  struct proc *pp;
+  int busy;
+
+  for (;;)
+  {
+    acquire(&tg_lock);
+    if (!tg->frozen)
+    {
+      tg->frozen = 1;
+      tg->stopper = p;
+      release(&tg_lock);
+      break;
+    }
+    release(&tg_lock);
+    // swapd has it frozen, and will soon give up, since
+    // p is running.
+    yield();
+  }
+
+  do
+  {
+    busy = 0;
+    for (pp = proc; pp < &proc[NPROC]; pp++)
+    {
+      if (pp == p)
+        continue;
+      acquire(&pp->lock);
+      if (pp->tg == tg && pp->state == RUNNING)
+        busy = 1;
+      release(&pp->lock);
+    }
+    if (busy)
+      yield();
+  } while (busy);
+}
+
+// Make the current process, a kernel process, a member of tg
+// for a while, working in tg's address space with tg's open
+// files and with cwd as its current directory, so that it can do
+// I/O on tg's behalf (see ioring.c). Sets aside what it had in v.
+// Returns 0 if it joined, 1 if tg is frozen for now, and -1 if
+// all of tg's members have exited. The caller must keep tg from
+// being freed and reused meanwhile. tgleave() undoes this.
+int tgjoin(struct tgroup *tg, struct inode *cwd, struct tgvisit *v)
+{
+  struct proc *pp, *p = myproc();
+  pagetable_t pagetable = 0, kpagetable = 0;
+  uint64 sz = 0;
+  int r;
+
+  for (pp = proc; pp < &proc[NPROC] && pagetable == 0; pp++)
+  {
+    if (pp == p)
+      continue;
+    acquire(&pp->lock);
+    if (pp->tg == tg && pp->state != UNUSED && pp->state != ZOMBIE)
+    {
+      pagetable = pp->pagetable;
+      kpagetable = pp->kpagetable;
+      sz = pp->sz;
+    }
+    release(&pp->lock);
+  }
+  if (pagetable == 0)
+    return -1;
+
+  // point p at tg before joining, so that a tgfreeze() that
+  // begins after the check below finds p running and fails.
+  v->tg = p->tg;
+  v->pagetable = p->pagetable;
+  v->kpagetable = p->kpagetable;
+  v->sz = p->sz;
+  v->cwd = p->cwd;
+  acquire(&p->lock);
+  p->tg = tg;
+  p->pagetable = pagetable;
+  p->kpagetable = kpagetable;
+  p->sz = sz;
+  p->cwd = cwd;
+  release(&p->lock);
+
+  acquire(&tg_lock);
+  r = (tg->nlive == 0) ? -1 : tg->frozen ? 1 : 0;
+  if (r == 0)
+  {
+    tg->ref++;
+    tg->nlive++;
+  }
+  release(&tg_lock);
+
+  acquire(&p->lock);
+  if (r != 0)
+  {
+    p->tg = v->tg;
+    p->pagetable = v->pagetable;
+    p->kpagetable = v->kpagetable;
+    p->sz = v->sz;
+    p->cwd = v->cwd;
+  }
+  asidswitch(p);
+  release(&p->lock);
+  return r;
+}
+
+// Leave the group that tgjoin() joined, and go back to what
+// was set aside in v. The last member out frees the group's
+// open files, and its address space.
+void tgleave(struct tgvisit *v)
+{
+  struct proc *p = myproc();
+  struct tgroup *tg = p->tg;
+  pagetable_t pagetable = p->pagetable;
+  pagetable_t kpagetable = p->kpagetable;
+  uint64 sz = p->sz;
+
+  acquire(&p->lock);
+  p->tg = v->tg;
+  p->pagetable = v->pagetable;
+  p->kpagetable = v->kpagetable;
+  p->sz = v->sz;
+  p->cwd = v->cwd;
+  asidswitch(p);
+  release(&p->lock);
+
+  tgexit(tg);
+  if (tgput(tg) == 0)
+  {
+    // the members have unmapped their own trapframes.
+    kvmfree(kpagetable);
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, sz);
+  }
+}
+
+// Move p into a thread group of its own, with copies of the
+// shared open files, if other threads share its current group.
+// exec() calls this before replacing p's address space; the old
+// group keeps the old one. Returns -1 if no group is free.
+int tgsplit(struct proc *p)
+{
+  struct tgroup *tg = p->tg, *ntg;
+  int shared;
+
+  acquire(&tg_lock);
+  shared = (tg->ref > 1);
+  release(&tg_lock);
+  if (!shared)
+    return 0;
+
+  if ((ntg = tgalloc()) == 0)
+    return -1;
+  acquire(&tg->lock);
+  for (int fd = 0; fd < NOFILE; fd++)
+    if (tg->ofile[fd])
+      ntg->ofile[fd] = filedup(tg->ofile[fd]);
+  release(&tg->lock);
+  p->tg = ntg;
+  tgexit(tg);
+  return 0;
+}
+
 // a user program that calls exec("/init")
 // od -t xC initcode
 uchar initcode[] = {
@@ -219,12 +616,13 @@ void userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
 
   // allocate one user page and copy init's instructions
   // and data into it.
   uvminit(p->pagetable, initcode, sizeof(initcode));
+  kvmsync(p->kpagetable, p->pagetable);
   p->sz = PGSIZE;
 
   // prepare for the very first "return" from kernel to user.
@@ -239,29 +637,81 @@ void userinit(void)
   release(&p->lock);
 }
 
+// Start a kernel process that runs fn, which never returns.
+// Like forkret(), fn must first release p->lock.
+void kproc(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if ((p = allocproc(0)) == 0)
+    panic("kproc");
+  p->context.ra = (uint64)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  __sync_fetch_and_add(&nkproc, 1);
+  release(&p->lock);
+}
+
 // Grow or shrink user memory by n bytes.
+// The new size applies to every thread sharing the page table.
 // Return 0 on success, -1 on failure.
 int growproc(int n)
 {
-  uint sz;
+  uint sz, nsz;
   struct proc *p = myproc();
 
+  if (n < 0)
+    tgstop(p);
+  acquire(&p->tg->lock);
   sz = p->sz;
   if (n > 0)
   {
-    if ((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0)
+    for (;;)
     {
-      return -1;
+      // user memory must stay below PLIC; see kvmcreate().
+      if (sz + n > PLIC)
+      {
+        release(&p->tg->lock);
+        return -1;
+      }
+      if ((nsz = uvmalloc(p->pagetable, sz, sz + n)) != 0)
+        break;
+      // out of memory: wait for swapd to free some.
+      release(&p->tg->lock);
+      if (swapwait() < 0)
+        return -1;
+      acquire(&p->tg->lock);
+      sz = p->sz;
     }
+    sz = nsz;
+    kvmsync(p->kpagetable, p->pagetable);
   }
   else if (n < 0)
   {
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    sz = uvmdeallocsync(p->pagetable, sz, sz + n);
+    kvmsync(p->kpagetable, p->pagetable);
+    asidflush(p->tg);
   }
-  p->sz = sz;
+  tgsetsz(p, sz);
+  release(&p->tg->lock);
+  if (n < 0)
+    tgthaw(p->tg);
   return 0;
 }
 
+// Set the size of p's user memory in every thread sharing
+// its page table. Caller must hold p->tg->lock.
+void tgsetsz(struct proc *p, uint64 sz)
+{
+  struct proc *pp;
+
+  for (pp = proc; pp < &proc[NPROC]; pp++)
+  {
+    if (pp->pagetable == p->pagetable)
+      pp->sz = sz;
+  }
+}
+
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
 int fork(void)
@@ -271,19 +721,24 @@ int fork(void)
   struct proc *p = myproc();
 
   // Allocate process.
-  if ((np = allocproc()) == 0)
+  if ((np = allocproc(0)) == 0)
   {
     return -1;
   }
 
-  // Copy user memory from parent to child.
+  // Copy user memory from parent to child, while other
+  // threads can't change it.
+  acquire(&p->tg->lock);
   if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0)
   {
+    release(&p->tg->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
   np->sz = p->sz;
+  release(&p->tg->lock);
+  kvmsync(np->kpagetable, np->pagetable);
 
   np->parent = p;
 
@@ -294,12 +749,61 @@ int fork(void)
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
+  acquire(&p->tg->lock);
   for (i = 0; i < NOFILE; i++)
-    if (p->ofile[i])
-      np->ofile[i] = filedup(p->ofile[i]);
+    if (p->tg->ofile[i])
+      np->tg->ofile[i] = filedup(p->tg->ofile[i]);
+  np->tg->text = p->tg->text;
+  if (np->tg->text.ip)
+    idup(np->tg->text.ip);
+  release(&p->tg->lock);
+  np->cwd = idup(p->cwd);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  np->tracemask = p->tracemask;
+
+  pid = np->pid;
+
+  np->state = RUNNABLE;
+
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a new thread that shares the caller's address space
+// and open files, and starts at user address fn with arg in a0
+// and sp at the top of the user stack stack.
+// Returns the new thread's pid, which join() takes.
+int clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  if (fn >= p->sz || stack > p->sz)
+    return -1;
+
+  if ((np = allocproc(p)) == 0)
+  {
+    return -1;
+  }
+
+  np->parent = p;
+
+  // start from the caller's registers (gp, tp, &c.),
+  // then enter fn(arg) on the new stack.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack & ~0xfL; // riscv sp must be 16-byte aligned
+  // returning from fn faults; the thread should call exit().
+  np->trapframe->ra = -1;
+
   np->cwd = idup(p->cwd);
 
   safestrcpy(np->name, p->name, sizeof(p->name));
+  np->tracemask = p->tracemask;
 
   pid = np->pid;
 
@@ -328,6 +832,8 @@ void reparent(struct proc *p)
       // because only the parent changes it, and we're the parent.
       acquire(&pp->lock);
       pp->parent = initproc;
+      // init reaps orphaned threads with wait(), like processes.
+      pp->thread = 0;
       // we should wake up init here, but that would require
       // initproc->lock, which would be a deadlock, since we hold
       // the lock on one of init's children (pp). this is why
@@ -347,16 +853,13 @@ void exit(int status)
   if (p == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for (int fd = 0; fd < NOFILE; fd++)
-  {
-    if (p->ofile[fd])
-    {
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  // a process's threads go with it; they become init's
+  // children below, for it to reap.
+  if (!p->thread)
+    tgkill(p);
+
+  // Close all open files, unless other threads still use them.
+  tgexit(p->tg);
 
   begin_op();
   iput(p->cwd);
@@ -408,6 +911,45 @@ void exit(int status)
 // Return -1 if this process has no children.
 int wait(uint64 addr)
 {
+  return waitchild(0, 0, addr, 0);
+}
+
+// Like wait(), also copying the child's resource usage, with
+// that of the children it waited for, to user address ruaddr.
+int wait2(uint64 addr, uint64 ruaddr)
+{
+  return waitchild(0, 0, addr, ruaddr);
+}
+
+// Wait for a thread this process created with clone() to exit,
+// and return its pid. If tid > 0, wait for that thread only.
+// Return -1 if there is no such thread.
+int join(int tid, uint64 addr)
+{
+  return waitchild(1, tid, addr, 0);
+}
+
+static void
+ruadd(struct rusage *a, struct rusage *b)
+{
+  a->utime += b->utime;
+  a->stime += b->stime;
+  a->nvcsw += b->nvcsw;
+  a->nivcsw += b->nivcsw;
+  a->faults += b->faults;
+  a->rbytes += b->rbytes;
+  a->wbytes += b->wbytes;
+  a->rblocks += b->rblocks;
+  a->wblocks += b->wblocks;
+}
+
+// Wait for a child to exit, as wait(), wait2() and join().
+// thread selects whether to look for threads or processes.
+// The child's usage is added to the caller's cru.
+static int
+waitchild(int thread, int tid, uint64 addr, uint64 ruaddr)
+{
+  struct rusage ru;
   struct proc *np;
   int havekids, pid;
   struct proc *p = myproc();
@@ -418,6 +960,7 @@ int wait(uint64 addr)
 
   for (;;)
   {
+  again:
     // Scan through table looking for exited children.
     havekids = 0;
     for (np = proc; np < &proc[NPROC]; np++)
@@ -425,7 +968,8 @@ int wait(uint64 addr)
       // this code uses np->parent without holding np->lock.
       // acquiring the lock first would cause a deadlock,
       // since np might be an ancestor, and we already hold p->lock.
-      if (np->parent == p)
+      if (np->parent == p && np->thread == thread &&
+          (tid <= 0 || np->pid == tid))
       {
         // np->parent can't change between the check and the acquire()
         // because only the parent changes it, and we're the parent.
@@ -435,13 +979,27 @@ int wait(uint64 addr)
         {
           // Found one.
           pid = np->pid;
+          ru = np->ru;
+          ruadd(&ru, &np->cru);
           if (addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
                                    sizeof(np->xstate)) < 0)
           {
             release(&np->lock);
+            if (vmretry(addr, PTE_W, &p->lock) == 0)
+              goto again;
             release(&p->lock);
             return -1;
           }
+          if (ruaddr != 0 && copyout(p->pagetable, ruaddr, (char *)&ru,
+                                     sizeof(ru)) < 0)
+          {
+            release(&np->lock);
+            if (vmretry(ruaddr, PTE_W, &p->lock) == 0)
+              goto again;
+            release(&p->lock);
+            return -1;
+          }
+          ruadd(&p->cru, &ru);
           freeproc(np);
           release(&np->lock);
           release(&p->lock);
@@ -480,6 +1038,7 @@ void scheduler(void)
   {
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
+    rcu_qs();
 
     int nproc = 0;
     for (p = proc; p < &proc[NPROC]; p++)
@@ -489,25 +1048,40 @@ void scheduler(void)
       {
         nproc++;
       }
-      if (p->state == RUNNABLE)
+      // a frozen group's threads must wait; p->tg is
+      // set for every runnable p.
+      if (p->state == RUNNABLE && (!p->tg->frozen || p->tg->stopper == p))
       {
         // Switch to chosen process.  It is the process's job
         // to release its lock and then reacquire it
         // before jumping back to us.
+        // Its kernel page table maps its user memory.
         p->state = RUNNING;
         c->proc = p;
+        asidswitch(p);
         swtch(&c->context, &p->context);
+        kstat(KS_CSWITCH, p->pid);
 
         // Process is done running for now.
         // It should have changed its p->state before coming back.
+        // Leave its kernel page table before releasing p->lock,
+        // after which a zombie's page tables may be freed.
+        asidswitch(0);
         c->proc = 0;
+        rcu_qs();
       }
       release(&p->lock);
     }
-    if (nproc <= 2)
-    { // only init and sh exist
-      intr_on();
+    if (nproc <= 2 + nkproc)
+    { // only init, sh and the kernel processes exist
+      // wfi returns on a pending interrupt even if they are
+      // off, so the handler runs only once this CPU stops
+      // counting as idle for rcu.
+      intr_off();
+      rcu_idle(1);
       asm volatile("wfi");
+      rcu_idle(0);
+      intr_on();
     }
   }
 }
@@ -590,6 +1164,7 @@ void sleep(void *chan, struct spinlock *lk)
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->ru.nvcsw++;
 
   sched();
 
@@ -621,6 +1196,19 @@ void wakeup(void *chan)
   }
 }
 
+// Wake up p if it is sleeping on chan, without scanning
+// the process table.
+// Must be called without any p->lock.
+void wakeproc(struct proc *p, void *chan)
+{
+  acquire(&p->lock);
+  if (p->state == SLEEPING && p->chan == chan)
+  {
+    p->state = RUNNABLE;
+  }
+  release(&p->lock);
+}
+
 // Wake up p if it is sleeping in wait(); used by exit().
 // Caller must hold p->lock.
 static void
@@ -634,9 +1222,39 @@ wakeup1(struct proc *p)
   }
 }
 
+// Mark p's threads killed: the other members of its group that
+// clone() made, whose parent is p or another of them. p must be
+// the caller, whose membership keeps the group from going away.
+// Takes each thread's lock on its own, holding no other, since
+// exit() and wait() take proc locks parent first.
+static void
+tgkill(struct proc *p)
+{
+  struct tgroup *tg = p->tg;
+  struct proc *pp;
+
+  for (pp = proc; pp < &proc[NPROC]; pp++)
+  {
+    // a racy look first, to lock only the group's threads;
+    // checked again under the lock, in case pp was reused.
+    if (pp == p || pp->tg != tg || !pp->thread)
+      continue;
+    acquire(&pp->lock);
+    if (pp->tg == tg && pp->thread && pp->state != UNUSED &&
+        pp->state != ZOMBIE)
+    {
+      pp->killed = 1;
+      if (pp->state == SLEEPING)
+        pp->state = RUNNABLE;
+    }
+    release(&pp->lock);
+  }
+}
+
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
-// to user space (see usertrap() in trap.c).
+// to user space (see usertrap() in trap.c). If it is not
+// itself a thread, its exit() stops its threads.
 int kill(int pid)
 {
   struct proc *p;
@@ -660,6 +1278,59 @@ int kill(int pid)
   return -1;
 }
 
+// Copy process pid's latency histogram for system call num
+// into hist. Returns -1 if there is no such process.
+int syslatcopy(int pid, int num, uint *hist)
+{
+  struct proc *p;
+
+  for (p = proc; p < &proc[NPROC]; p++)
+  {
+    acquire(&p->lock);
+    if (p->pid == pid && p->state != UNUSED)
+    {
+      memmove(hist, p->syslat[num], sizeof(p->syslat[num]));
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Copy a struct procinfo for each of up to n processes to
+// user address addr. Returns how many it copied.
+int procinfo(uint64 addr, int n)
+{
+  struct procinfo pi;
+  struct proc *p;
+  int i = 0;
+
+  for (p = proc; p < &proc[NPROC] && i < n; p++)
+  {
+    acquire(&p->lock);
+    if (p->state == UNUSED)
+    {
+      release(&p->lock);
+      continue;
+    }
+    pi.pid = p->pid;
+    pi.ppid = p->parent ? p->parent->pid : 0;
+    pi.state = p->state;
+    pi.thread = p->thread;
+    pi.sz = p->sz;
+    safestrcpy(pi.name, p->name, sizeof(pi.name));
+    pi.ru = p->ru;
+    pi.cru = p->cru;
+    release(&p->lock);
+    // copyout() may fault, so not holding p->lock.
+    if (copyout(myproc()->pagetable, addr + i * sizeof(pi), (char *)&pi, sizeof(pi)) < 0)
+      return -1;
+    i++;
+  }
+  return i;
+}
+
 // Copy to either a user address, or kernel address,
 // depending on usr_dst.
 // Returns 0 on success, -1 on error.
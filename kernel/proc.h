@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint64 asidgen;             // ASID generation this hart's TLB holds
 };
 
 extern struct cpu cpus[NCPU];
@@ -82,6 +83,50 @@ struct trapframe {
 
 enum procstate { UNUSED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// The read-only program segment that exec() leaves for
+// vmfault() to map page by page through the text cache.
+struct textseg {
+  struct inode *ip;            // Program file, or 0 if none
+  uint64 va;                   // Page-aligned start of the segment
+  uint64 end;                  // End of the segment in memory
+  uint64 fileend;              // End of the part read from the file
+  uint off;                    // File offset of va
+  int perm;                    // PTE permissions for its pages
+};
+
+// A thread group: the user address space and open-file table
+// shared by a process and the threads it creates with clone().
+// A process that never calls clone() is a group of one.
+struct tgroup {
+  struct spinlock lock;        // protects ofile[] and the shared page table
+
+  // tg_lock must be held when using these:
+  int ref;                     // Procs whose page table belongs to the group
+  int nlive;                   // Procs that have not yet exited
+  int frozen;                  // Members may not run; see tgfreeze()
+  struct proc *stopper;        // Member that runs while frozen; see tgstop()
+
+  struct file *ofile[NOFILE];  // Open files
+  struct textseg text;         // Program text mapped on demand
+
+  // see asid.c
+  uint64 asid;                 // Generation << 16 | ASID; 0 if none yet
+  uint cpus;                   // Harts that may cache the group's TLB entries
+  uint stale;                  // Harts that must flush them before running it
+};
+
+extern struct tgroup tgroups[NPROC];
+
+// What a kernel process sets aside while tgjoin()
+// has it work in a thread group.
+struct tgvisit {
+  struct tgroup *tg;
+  pagetable_t pagetable;
+  pagetable_t kpagetable;
+  uint64 sz;
+  struct inode *cwd;
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -93,14 +138,23 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int thread;                  // Created by clone(); reaped by join()
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, also mapping user memory
   struct trapframe *trapframe; // data page for trampoline.S
+  uint64 trapframeva;          // User virtual address of trapframe
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct tgroup *tg;           // Shared address space and open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+
+  // written only by the process itself.
+  uint64 tracemask;            // System calls to trace; see syscall.c
+  uint syslat[NSYSLAT][NSYSHIST]; // System call latencies
+  struct rusage ru;            // Resources used; see rusage.h
+  struct rusage cru;           // Resources used by waited-for children
 };
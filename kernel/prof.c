@@ -0,0 +1,183 @@
+// Sampling profiler.
+//
+// Writing "start rate" to the prof device speeds each CPU's timer
+// up to interrupt rate times per clock tick, and has each of those
+// interrupts record where the CPU was: the pc, and for the kernel,
+// the return addresses in the frames of the stack (the kernel is
+// compiled with frame pointers), along with the current process.
+// Only every rate'th interrupt is a clock tick, so ticks and
+// scheduling go on as before. "stop" puts the timers back.
+//
+// Each CPU keeps its samples in a ring of its own; reading the
+// prof device empties the rings into struct profsamples. A
+// sample finding its ring full is dropped. See user/prof.c for
+// how to turn them into profiles.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "prof.h"
+#include "defs.h"
+
+#define NPROFSAMPLE 256   // samples each CPU holds
+
+extern uint64 timer_scratch[NCPU][8];
+extern char kernelvec[];
+
+static struct profcpu {
+  struct profsample s[NPROFSAMPLE];
+  uint head;      // samples taken; only this CPU writes it
+  uint tail;      // samples read; under prof.lock
+  uint nintr;     // timer interrupts
+} profcpu[NCPU];
+
+static struct {
+  struct spinlock lock;
+  int rate;       // samples per tick; 0 if not profiling
+} prof;
+
+static int profread(int, uint64, int);
+static int profwrite(int, uint64, int);
+
+void
+profinit(void)
+{
+  initlock(&prof.lock, "prof");
+  devsw[PROF].read = profread;
+  devsw[PROF].write = profwrite;
+}
+
+// Fill in s->pc[1...] with the return addresses of the kernel
+// code that the timer interrupted. kernelvec calls kerneltrap()
+// without touching s0, so the frame whose return address is in
+// kernelvec is kerneltrap()'s, and the frame before it is the
+// interrupted function's.
+static void
+backtrace(struct profsample *s)
+{
+  uint64 fp = r_fp(), top = PGROUNDUP(fp), ra;
+  int i = 1, found = 0;
+
+  while(fp < top && fp >= top - PGSIZE && i < PROFDEPTH){
+    ra = *(uint64*)(fp - 8);
+    if(found)
+      s->pc[i++] = ra;
+    else if(ra >= (uint64)kernelvec && ra < (uint64)kernelvec + 512)
+      found = 1;
+    fp = *(uint64*)(fp - 16);
+  }
+}
+
+static void
+sample(struct profcpu *c)
+{
+  struct profsample *s;
+  struct proc *p = myproc();
+
+  if(c->head - __atomic_load_n(&c->tail, __ATOMIC_ACQUIRE) >= NPROFSAMPLE)
+    return;
+  s = &c->s[c->head % NPROFSAMPLE];
+  memset(s, 0, sizeof(*s));
+  s->pc[0] = r_sepc();
+  s->user = (r_sstatus() & SSTATUS_SPP) == 0;
+  if(!s->user)
+    backtrace(s);
+  s->cpu = cpuid();
+  if(p){
+    s->pid = p->pid;
+    safestrcpy(s->name, p->name, sizeof(s->name));
+  }
+  __atomic_store_n(&c->head, c->head + 1, __ATOMIC_RELEASE);
+}
+
+// A timer interrupt: take a sample if profiling. Returns 1 if the
+// interrupt is also a clock tick. Interrupts must be off.
+int
+proftick(void)
+{
+  struct profcpu *c = &profcpu[cpuid()];
+  int rate = __atomic_load_n(&prof.rate, __ATOMIC_RELAXED);
+
+  if(rate == 0)
+    return 1;
+  sample(c);
+  return ++c->nintr % rate == 0;
+}
+
+// Set every CPU's timer to interrupt rate times a tick,
+// or once if rate is 0. The change takes effect at each
+// CPU's next timer interrupt.
+static void
+setrate(int rate)
+{
+  for(int i = 0; i < NCPU; i++)
+    __atomic_store_n(&timer_scratch[i][4], TICKCYCLES / (rate ? rate : 1),
+                     __ATOMIC_RELAXED);
+  __atomic_store_n(&prof.rate, rate, __ATOMIC_RELAXED);
+}
+
+// "start rate" or "stop".
+static int
+profwrite(int user_src, uint64 src, int n)
+{
+  char cmd[32], *s;
+  int rate = 0;
+
+  if(n <= 0 || n >= sizeof(cmd) || either_copyin(cmd, user_src, src, n) < 0)
+    return -1;
+  cmd[n] = 0;
+  if(strncmp(cmd, "start ", 6) == 0){
+    for(s = cmd + 6; *s >= '0' && *s <= '9' && rate <= PROFMAXRATE; s++)
+      rate = rate*10 + *s - '0';
+    if(rate <= 0 || rate > PROFMAXRATE)
+      return -1;
+  } else if(strncmp(cmd, "stop", 4) != 0)
+    return -1;
+  acquire(&prof.lock);
+  setrate(rate);
+  release(&prof.lock);
+  return n;
+}
+
+// Copy out as many whole samples as fit in n bytes, each CPU's
+// in the order taken. Returns 0 if there are none, -1 if dst is
+// bad.
+static int
+profread(int user_dst, uint64 dst, int n)
+{
+  struct profsample s;
+  struct profcpu *c;
+  int tot = 0;
+
+  // fault the destination in first, as ktraceread() does; a
+  // sample is consumed only once it is copied out.
+  if(user_dst)
+    vmtouch(dst, n, PTE_W);
+  acquire(&prof.lock);
+  for(c = profcpu; c < &profcpu[NCPU]; c++){
+    while(c->tail != __atomic_load_n(&c->head, __ATOMIC_ACQUIRE) &&
+          tot + sizeof(s) <= n){
+      s = c->s[c->tail % NPROFSAMPLE];
+      if(either_copyout(user_dst, dst + tot, &s, sizeof(s)) < 0){
+        if(user_dst && (vmretry(dst + tot, PTE_W, &prof.lock) == 0 ||
+                        vmretry(dst + tot + sizeof(s) - 1, PTE_W, &prof.lock) == 0))
+          continue;
+        if(tot == 0)
+          tot = -1;
+        goto out;
+      }
+      __atomic_store_n(&c->tail, c->tail + 1, __ATOMIC_RELEASE);
+      tot += sizeof(s);
+    }
+  }
+out:
+  release(&prof.lock);
+  return tot;
+}
@@ -0,0 +1,14 @@
+// Sampling profiler; see prof.c.
+
+#define PROFDEPTH   8     // pcs in a sample
+#define PROFMAXRATE 100   // most samples per clock tick
+
+// A sample, as reading the prof device returns it.
+struct profsample {
+  uint64 pc[PROFDEPTH];  // where the CPU was, then its callers;
+                         // the rest 0. Only kernel samples have callers.
+  uint pid;              // 0 if no process
+  ushort cpu;
+  ushort user;           // pc[0] is a user address
+  char name[16];         // the process's name
+};
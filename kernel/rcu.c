@@ -0,0 +1,192 @@
+// Read-copy-update.
+//
+// Code that only looks things up can do it between rcu_read_lock()
+// and rcu_read_unlock(), holding no lock, provided that whoever
+// removes an object from where readers find it waits before freeing
+// it: either with synchronize_rcu(), which returns once every
+// reader that might still see the object is done, or with
+// call_rcu() or kfree_rcu(), which have rcud, a kernel process,
+// free it later.
+//
+// A reader must not sleep or yield, and rcu_read_lock() turns
+// interrupts off, so no timer interrupt can make it yield either.
+// So once each CPU has passed through scheduler(), or has been
+// idle, since an object was removed, no reader can still see it.
+// Each CPU counts its passes; synchronize_rcu() waits for every
+// running CPU's count to move on.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "rcu.h"
+#include "defs.h"
+
+#define NRCUFREE 64   // pages kfree_rcu() can have waiting
+
+// Each CPU writes only its own entries. 0 passes means the CPU
+// hasn't started yet, and so can't be in a reader.
+uint64 rcupasses[NCPU];
+int rcuidle[NCPU];      // CPU is waiting for an interrupt
+
+struct {
+  struct spinlock lock;
+  struct rcu_head *next;       // callbacks waiting for rcud
+  uint64 pages[NRCUFREE];      // pages waiting for rcud
+  int npages;
+} rcu;
+
+void
+rcuinit(void)
+{
+  initlock(&rcu.lock, "rcu");
+}
+
+void
+rcu_read_lock(void)
+{
+  push_off();
+}
+
+void
+rcu_read_unlock(void)
+{
+  pop_off();
+}
+
+// This CPU is in scheduler(), outside any reader.
+void
+rcu_qs(void)
+{
+  int id = cpuid();
+
+  __atomic_store_n(&rcupasses[id], rcupasses[id] + 1, __ATOMIC_RELEASE);
+}
+
+// This CPU is about to wait for an interrupt, if idle is set,
+// or has stopped waiting.
+void
+rcu_idle(int idle)
+{
+  int id = cpuid();
+
+  if(!idle)
+    rcu_qs();
+  __atomic_store_n(&rcuidle[id], idle, __ATOMIC_RELEASE);
+}
+
+// Wait until every reader that started before now has finished.
+// The caller must be a process, holding no spinlocks, and not
+// itself in a reader.
+void
+synchronize_rcu(void)
+{
+  uint64 snap[NCPU];
+  int i;
+
+  for(i = 0; i < NCPU; i++)
+    snap[i] = __atomic_load_n(&rcupasses[i], __ATOMIC_ACQUIRE);
+  for(i = 0; i < NCPU; i++){
+    if(snap[i] == 0)
+      continue;
+    // yielding takes this CPU, too, through scheduler().
+    while(__atomic_load_n(&rcupasses[i], __ATOMIC_ACQUIRE) == snap[i] &&
+          !__atomic_load_n(&rcuidle[i], __ATOMIC_ACQUIRE))
+      yield();
+  }
+}
+
+// Have rcud call func(head) once every reader that might see the
+// object holding head is done. Doesn't sleep.
+void
+call_rcu(struct rcu_head *head, void (*func)(struct rcu_head*))
+{
+  head->func = func;
+  acquire(&rcu.lock);
+  head->next = rcu.next;
+  rcu.next = head;
+  wakeup(&rcu);
+  release(&rcu.lock);
+}
+
+// kfree() page pa once every reader that might see it is done.
+// Sleeps, if too many pages are waiting already.
+void
+kfree_rcu(void *pa)
+{
+  acquire(&rcu.lock);
+  if(rcu.npages == NRCUFREE){
+    release(&rcu.lock);
+    synchronize_rcu();
+    kfree(pa);
+    return;
+  }
+  rcu.pages[rcu.npages++] = (uint64)pa;
+  wakeup(&rcu);
+  release(&rcu.lock);
+}
+
+// rcud's body; kproc() starts it.
+void
+rcud(void)
+{
+  struct rcu_head *h, *next;
+  uint64 pages[NRCUFREE];
+  int n;
+
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  acquire(&rcu.lock);
+  for(;;){
+    while(rcu.next == 0 && rcu.npages == 0)
+      sleep(&rcu, &rcu.lock);
+    h = rcu.next;
+    rcu.next = 0;
+    n = rcu.npages;
+    memmove(pages, rcu.pages, n * sizeof(pages[0]));
+    rcu.npages = 0;
+    release(&rcu.lock);
+
+    synchronize_rcu();
+    for(; h; h = next){
+      next = h->next;
+      h->func(h);
+    }
+    for(int i = 0; i < n; i++)
+      kfree((void*)pages[i]);
+
+    acquire(&rcu.lock);
+  }
+}
+
+struct rcucheck {
+  struct rcu_head head;   // first, so a callback can cast back
+  int ran;
+};
+
+static void
+rcutestdone(struct rcu_head *h)
+{
+  __atomic_store_n(&((struct rcucheck*)h)->ran, 1, __ATOMIC_RELEASE);
+}
+
+// Check that a grace period ends and that rcud runs a callback;
+// the statistics device's "rcutest" command calls it, so that
+// usertests can. The callback's head lives on this stack, so
+// wait for it however long rcud takes.
+int
+rcutest(void)
+{
+  struct rcucheck t;
+
+  t.ran = 0;
+  synchronize_rcu();
+  call_rcu(&t.head, rcutestdone);
+  while(!__atomic_load_n(&t.ran, __ATOMIC_ACQUIRE))
+    yield();
+  return 0;
+}
@@ -0,0 +1,5 @@
+// Read-copy-update; see rcu.c.
+struct rcu_head {
+  struct rcu_head *next;
+  void (*func)(struct rcu_head*);
+};
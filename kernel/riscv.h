@@ -40,6 +40,7 @@ w_mepc(uint64 x)
 
 // Supervisor Status Register, sstatus
 
+#define SSTATUS_SUM (1L << 18) // Supervisor may access User pages
 #define SSTATUS_SPP (1L << 8)  // Previous mode, 1=Supervisor, 0=User
 #define SSTATUS_SPIE (1L << 5) // Supervisor Previous Interrupt Enable
 #define SSTATUS_UPIE (1L << 4) // User Previous Interrupt Enable
@@ -184,7 +185,10 @@ w_mtvec(uint64 x)
 // use riscv's sv39 page table scheme.
 #define SATP_SV39 (8L << 60)
 
-#define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
+// the address-space identifier field, bits 44-59.
+#define SATP_ASID(asid) (((uint64)(asid)) << 44)
+
+#define MAKE_SATP(pagetable, asid) (SATP_SV39 | SATP_ASID(asid) | (((uint64)pagetable) >> 12))
 
 // supervisor address translation and protection;
 // holds the address of the page table.
@@ -287,6 +291,16 @@ r_sp()
   return x;
 }
 
+// read the frame pointer, s0, which the kernel is
+// compiled to keep (-fno-omit-frame-pointer).
+static inline uint64
+r_fp()
+{
+  uint64 x;
+  asm volatile("mv %0, s0" : "=r" (x) );
+  return x;
+}
+
 // read and write tp, the thread pointer, which holds
 // this core's hartid (core number), the index into cpus[].
 static inline uint64
@@ -319,6 +333,13 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
@@ -326,19 +347,35 @@ sfence_vma()
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
 
+// a megapage is mapped by a leaf PTE in a level-1 page table.
+#define MEGAPGSIZE (512*PGSIZE) // bytes per megapage (2 MiB)
+
 #define PTE_V (1L << 0) // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_G (1L << 5) // 1 -> mapped in every address space
+#define PTE_A (1L << 6) // accessed since last cleared
+#define PTE_D (1L << 7) // written since last cleared
+#define PTE_SWAP (1L << 8) // not valid; page is in swap slot PTE2SLOT
+#define PTE_SHARED (1L << 9) // shared memory; fork shares, not copies
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
 
 #define PTE2PA(pte) (((pte) >> 10) << 12)
 
+// a swapped-out page's PTE holds its swap slot in place of the PPN.
+#define SLOT2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SLOT(pte) ((pte) >> 10)
+
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a PTE with any of R/W/X set is a leaf; otherwise, if valid,
+// it points to the next-level page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
@@ -352,3 +389,11 @@ sfence_vma()
 
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t; // 512 PTEs
+
+// a position in a page table, for operations on runs of
+// consecutive pages; see cursorinit() in vm.c.
+struct ptcursor {
+  pagetable_t pagetable;
+  uint64 base;       // virtual address mapped by table[0]
+  pagetable_t table; // level-0 page table last walked to, or 0
+};
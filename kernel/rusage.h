@@ -0,0 +1,25 @@
+// Resource usage of a process, as wait2() and procinfo() return
+// it. Times are in clock ticks, as uptime() counts them.
+struct rusage {
+  uint64 utime;     // ticks spent running in user space
+  uint64 stime;     // ticks spent running in the kernel
+  uint64 nvcsw;     // times it gave up the CPU to sleep
+  uint64 nivcsw;    // times it was made to give up the CPU
+  uint64 faults;    // page faults
+  uint64 rbytes;    // bytes read and written through read(), write() &c
+  uint64 wbytes;
+  uint64 rblocks;   // disk blocks read and written on its behalf
+  uint64 wblocks;
+};
+
+// A process, as procinfo() lists it.
+struct procinfo {
+  int pid;
+  int ppid;         // 0 if none
+  int state;        // enum procstate in proc.h
+  int thread;       // created by clone()
+  uint64 sz;        // bytes of user memory
+  char name[16];
+  struct rusage ru;   // its own usage
+  struct rusage cru;  // that of the children it has waited for
+};
@@ -0,0 +1,237 @@
+// Shared memory segments.
+//
+// shmat() attaches a segment of pages to the calling process,
+// mapping it at the top of the process's memory, as sbrk() would,
+// with PTE_SHARED set. A segment is found by key, or created if no
+// segment has that key; key 0 always creates a new, anonymous
+// segment, which only the process and the children it forks
+// afterwards can share. shmdt() detaches a segment.
+//
+// Each page of a segment has a reference for the segment table and
+// one for each page table that maps it (see kdup() in kalloc.c).
+// uvmcopy() shares PTE_SHARED pages with a forked child instead of
+// copying them, and uvmunmap(), whether from shmdt(), sbrk(), exit
+// or exec, drops the page table's reference. A segment that no page
+// table maps any more is gone: the next shmat() frees its pages, or
+// the shrinker that swapd runs does, whichever comes first.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+#define SHMMAXPG (SHMMAX / PGSIZE)
+
+struct shmseg {
+  int key;         // 0 if anonymous
+  int npages;      // 0 if the slot is free
+  int busy;        // pages being allocated; others wait
+  uint64 pages[SHMMAXPG];
+};
+
+struct {
+  struct spinlock lock;
+  struct shmseg seg[NSHM];
+} shm;
+
+static int shmshrink(int);
+
+void
+shminit(void)
+{
+  initlock(&shm.lock, "shm");
+  kshrinker("shm", shmshrink);
+}
+
+// Does no page table map s any more?
+// Caller must hold shm.lock.
+static int
+unmapped(struct shmseg *s)
+{
+  for(int i = 0; i < s->npages; i++)
+    if(krefs((void*)s->pages[i]) > 1)
+      return 0;
+  return 1;
+}
+
+// Free s's pages and its slot. Returns the number of pages.
+// Caller must hold shm.lock.
+static int
+segfree(struct shmseg *s)
+{
+  int n = s->npages;
+
+  for(int i = 0; i < n; i++)
+    kfree((void*)s->pages[i]);
+  s->npages = 0;
+  s->key = 0;
+  return n;
+}
+
+// kalloc()'s shrinker: free segments that no page table maps,
+// until at least n pages are free. Returns the number freed.
+static int
+shmshrink(int n)
+{
+  struct shmseg *s;
+  int freed = 0;
+
+  acquire(&shm.lock);
+  for(s = shm.seg; s < &shm.seg[NSHM] && freed < n; s++)
+    if(s->npages && !s->busy && unmapped(s))
+      freed += segfree(s);
+  release(&shm.lock);
+  return freed;
+}
+
+// Find the segment with key, or create one of n zeroed pages,
+// and take a reference to each of its first n pages for the
+// caller to map. Returns 0 if the segment is smaller than n
+// pages, or there is no free slot or memory.
+static struct shmseg *
+shmget(int key, int n)
+{
+  struct shmseg *s, *found, *free;
+  char *mem;
+  int i;
+
+  acquire(&shm.lock);
+  for(;;){
+    found = free = 0;
+    for(s = shm.seg; s < &shm.seg[NSHM]; s++){
+      if(s->npages && !s->busy && unmapped(s))
+        segfree(s);
+      if(s->npages == 0 && !s->busy){
+        if(free == 0)
+          free = s;
+      } else if(key != 0 && s->key == key){
+        found = s;
+        break;
+      }
+    }
+    if(found == 0 || !found->busy)
+      break;
+    sleep(found, &shm.lock);
+  }
+
+  if(found){
+    s = found;
+    if(s->npages < n){
+      release(&shm.lock);
+      return 0;
+    }
+  } else {
+    if((s = free) == 0){
+      release(&shm.lock);
+      return 0;
+    }
+    // busy keeps the slot ours, so allocate without the lock.
+    s->key = key;
+    s->busy = 1;
+    release(&shm.lock);
+    for(i = 0; i < n; i++){
+      if((mem = kalloc()) == 0)
+        break;
+      memset(mem, 0, PGSIZE);
+      s->pages[i] = (uint64)mem;
+    }
+    acquire(&shm.lock);
+    s->busy = 0;
+    s->npages = i;
+    wakeup(s);
+    if(i < n){
+      segfree(s);
+      release(&shm.lock);
+      return 0;
+    }
+  }
+  for(i = 0; i < n; i++)
+    kdup((void*)s->pages[i]);
+  release(&shm.lock);
+  return s;
+}
+
+// Attach the segment with key, of at least size bytes, to the
+// current process, creating it if need be. Returns its address,
+// or -1.
+uint64
+shmat(int key, int size)
+{
+  struct proc *p = myproc();
+  struct shmseg *s;
+  uint64 va;
+  int i, n;
+
+  if(size <= 0 || size > SHMMAX)
+    return -1;
+  n = PGROUNDUP(size) / PGSIZE;
+  if((s = shmget(key, n)) == 0)
+    return -1;
+
+  // the references shmget() took keep s->pages[] from changing.
+  acquire(&p->tg->lock);
+  va = PGROUNDUP(p->sz);
+  i = 0;
+  if(va + n*PGSIZE <= PLIC){
+    for(; i < n; i++)
+      if(mappages(p->pagetable, va + i*PGSIZE, PGSIZE, s->pages[i],
+                  PTE_R|PTE_W|PTE_U|PTE_SHARED) != 0)
+        break;
+  }
+  if(i < n){
+    uvmunmap(p->pagetable, va, i, 1);
+    for(; i < n; i++)
+      kfree((void*)s->pages[i]);
+    release(&p->tg->lock);
+    return -1;
+  }
+  kvmsync(p->kpagetable, p->pagetable);
+  tgsetsz(p, va + n*PGSIZE);
+  release(&p->tg->lock);
+  return va;
+}
+
+// Detach the segment that shmat() attached at addr from the
+// current process. Returns -1 if there is none there.
+int
+shmdt(uint64 addr)
+{
+  struct proc *p = myproc();
+  struct shmseg *s;
+  uint64 pa;
+  int n = 0;
+
+  if(addr % PGSIZE != 0)
+    return -1;
+
+  tgstop(p);
+  acquire(&p->tg->lock);
+  if((pa = walkaddr(p->pagetable, addr)) != 0){
+    acquire(&shm.lock);
+    for(s = shm.seg; s < &shm.seg[NSHM]; s++){
+      if(s->npages && s->pages[0] == pa){
+        while(n < s->npages &&
+              walkaddr(p->pagetable, addr + n*PGSIZE) == s->pages[n])
+          n++;
+        break;
+      }
+    }
+    release(&shm.lock);
+  }
+  if(n == 0){
+    release(&p->tg->lock);
+    tgthaw(p->tg);
+    return -1;
+  }
+  uvmunmapsync(p->pagetable, addr, n);
+  asidflush(p->tg);
+  if(addr + n*PGSIZE >= p->sz)
+    tgsetsz(p, addr);
+  release(&p->tg->lock);
+  tgthaw(p->tg);
+  return 0;
+}
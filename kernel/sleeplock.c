@@ -1,4 +1,9 @@
 // Sleeping locks
+//
+// A process that finds a sleep lock held spins, rather than
+// sleeps, while the holder is running on another CPU: the holder
+// will likely release the lock sooner than a sleep and wakeup
+// could be done. Release calls wakeup() only if someone sleeps.
 
 #include "types.h"
 #include "riscv.h"
@@ -6,15 +11,35 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "sleeplock.h"
 
+// *locked is held by o. If o is running, release lk, spin until
+// o releases *locked or stops running, reacquire lk and return 1;
+// otherwise return 0, and the caller should sleep.
+static int
+spinowner(struct spinlock *lk, uint *locked, struct proc **owner, struct proc *o)
+{
+  if (o == 0 || __atomic_load_n(&o->state, __ATOMIC_RELAXED) != RUNNING)
+    return 0;
+  release(lk);
+  while (__atomic_load_n(locked, __ATOMIC_RELAXED) &&
+         __atomic_load_n(owner, __ATOMIC_RELAXED) == o &&
+         __atomic_load_n(&o->state, __ATOMIC_RELAXED) == RUNNING)
+    ;
+  acquire(lk);
+  return 1;
+}
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
   initlock(&lk->lk, "sleep lock");
   lk->name = name;
   lk->locked = 0;
+  lk->owner = 0;
+  lk->nwait = 0;
   lk->pid = 0;
 }
 
@@ -23,9 +48,14 @@ acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   while (lk->locked) {
+    if (spinowner(&lk->lk, &lk->locked, &lk->owner, lk->owner))
+      continue;
+    lk->nwait++;
     sleep(lk, &lk->lk);
+    lk->nwait--;
   }
   lk->locked = 1;
+  lk->owner = myproc();
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
@@ -35,8 +65,10 @@ releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
-  wakeup(lk);
+  if (lk->nwait)
+    wakeup(lk);
   release(&lk->lk);
 }
 
@@ -51,5 +83,83 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+void
+initrwsleeplock(struct rwsleeplock *lk, char *name)
+{
+  initlock(&lk->lk, "rwsleep lock");
+  lk->name = name;
+  lk->readers = 0;
+  lk->locked = 0;
+  lk->wwait = 0;
+  lk->owner = 0;
+  lk->nwait = 0;
+  lk->pid = 0;
+}
+
+// Readers have no owner to watch, so only a writer's
+// holding lk makes others spin.
+void
+acquirereadsleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  while (lk->locked || lk->wwait) {
+    if (lk->locked && spinowner(&lk->lk, &lk->locked, &lk->owner, lk->owner))
+      continue;
+    lk->nwait++;
+    sleep(lk, &lk->lk);
+    lk->nwait--;
+  }
+  lk->readers++;
+  release(&lk->lk);
+}
+
+void
+acquirewritesleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  lk->wwait++;
+  while (lk->locked || lk->readers) {
+    if (lk->locked && spinowner(&lk->lk, &lk->locked, &lk->owner, lk->owner))
+      continue;
+    lk->nwait++;
+    sleep(lk, &lk->lk);
+    lk->nwait--;
+  }
+  lk->wwait--;
+  lk->locked = 1;
+  lk->owner = myproc();
+  lk->pid = myproc()->pid;
+  release(&lk->lk);
+}
+
+// Release lk, whichever way the caller holds it.
+void
+releaserwsleep(struct rwsleeplock *lk)
+{
+  acquire(&lk->lk);
+  if (lk->locked && lk->pid == myproc()->pid) {
+    lk->locked = 0;
+    lk->owner = 0;
+    lk->pid = 0;
+    if (lk->nwait)
+      wakeup(lk);
+  } else if (lk->readers > 0) {
+    if (--lk->readers == 0 && lk->nwait)
+      wakeup(lk);
+  } else
+    panic("releaserwsleep");
+  release(&lk->lk);
+}
 
+// Is lk held for writing by this process, or if shared is set,
+// by anyone for reading?
+int
+holdingrwsleep(struct rwsleeplock *lk, int shared)
+{
+  int r;
 
+  acquire(&lk->lk);
+  r = (lk->locked && lk->pid == myproc()->pid) || (shared && lk->readers > 0);
+  release(&lk->lk);
+  return r;
+}
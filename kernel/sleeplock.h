@@ -2,9 +2,27 @@
 struct sleeplock {
   uint locked;       // Is the lock held?
   struct spinlock lk; // spinlock protecting this sleep lock
+  struct proc *owner; // Process holding lock
+  int nwait;         // Processes asleep waiting for it
   
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
 };
 
+// Long-term reader-writer locks: any number of readers, or one
+// writer. Like struct rwspinlock, a waiting writer keeps new
+// readers out.
+struct rwsleeplock {
+  int readers;       // Processes holding it to read
+  uint locked;       // Is it held to write?
+  int wwait;         // Writers waiting
+  struct spinlock lk; // spinlock protecting this sleep lock
+  struct proc *owner; // Process holding it to write
+  int nwait;         // Processes asleep waiting for it
+
+  // For debugging:
+  char *name;        // Name of lock.
+  int pid;           // Process holding it to write
+};
+
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "riscv.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -45,20 +46,205 @@ findslot(struct spinlock *lk)
   }
   panic("findslot");
 }
+
+// Count a duration of t ticks in histogram h.
+static void
+lockhist(uint *h, uint64 t)
+{
+  int i = 0;
+
+  while (t > 0 && i < NLOCKHIST - 1)
+  {
+    t >>= 1;
+    i++;
+  }
+  h[i]++;
+}
+#endif
+
+#ifdef LOCKDEP
+// Lock dependency checking, for kernels built with LOCKDEP=1.
+//
+// Locks fall into classes by name, less any trailing digits, so
+// that kmem_0 and kmem_1 are one class. acquire() notes that the
+// class of each lock the CPU already holds came before the class
+// of the lock it is acquiring. If the opposite order has been
+// seen too, two CPUs could deadlock, each holding a lock the
+// other wants; acquire() records the pair, and statslockdep()
+// reports it, along with how long locks of each class are held.
+// Only direct inversions are found, not longer cycles, and locks
+// of one class may nest, as proc locks do in wait().
+// Reader-writer spinlocks are checked too, whether taken for
+// reading or writing; sleep locks are not.
+#define NLOCKCLASS 64   // at most 64: after is a bitmap
+#define NHELD      16   // most spinlocks one CPU holds at once
+
+static struct lockclass {
+  char name[16];
+  uint64 after;     // classes acquired while holding this one
+  uint64 inverted;  // and of those, ones also acquired before it
+  uint64 nhold;
+  uint64 sumhold;   // ticks held, in all
+  uint64 maxhold;
+} classes[NLOCKCLASS];
+static int nclasses;
+static uint classlock;   // not a spinlock, which would need a class
+
+// the spinlocks and reader-writer spinlocks each CPU holds.
+static struct held {
+  void *lk;
+  int class;
+  uint64 t0;        // when it was acquired
+} held[NCPU][NHELD];
+static int nheld[NCPU];
+
+// The class of locks named name.
+static int
+lockclass(char *name)
+{
+  int n, c;
+
+  for (n = strlen(name); n > 0 && name[n - 1] >= '0' && name[n - 1] <= '9'; n--)
+    ;
+  if (n > sizeof(classes[0].name) - 1)
+    n = sizeof(classes[0].name) - 1;
+
+  push_off();
+  while (__sync_lock_test_and_set(&classlock, 1) != 0)
+    ;
+  for (c = 0; c < nclasses; c++)
+    if (strncmp(classes[c].name, name, n) == 0 && classes[c].name[n] == 0)
+      break;
+  if (c == nclasses)
+  {
+    if (nclasses < NLOCKCLASS)
+    {
+      memmove(classes[c].name, name, n);
+      nclasses++;
+    }
+    else
+      c = -1;
+  }
+  __sync_lock_release(&classlock);
+  pop_off();
+  return c;
+}
+
+// Note the order of a lock of class c after the locks this
+// CPU holds. Interrupts must be off.
+static void
+lockdep_order(int c)
+{
+  int id = cpuid(), h;
+
+  if (c < 0)
+    return;
+  for (int i = 0; i < nheld[id]; i++)
+  {
+    h = held[id][i].class;
+    if (h < 0 || h == c)
+      continue;
+    if ((classes[h].after & (1L << c)) == 0)
+      __sync_fetch_and_or(&classes[h].after, 1L << c);
+    if ((classes[c].after & (1L << h)) && (classes[c].inverted & (1L << h)) == 0)
+      __sync_fetch_and_or(&classes[c].inverted, 1L << h);
+  }
+}
+
+// lk, of class c, is now held by this CPU.
+static void
+lockdep_held(void *lk, int c)
+{
+  int id = cpuid();
+
+  if (nheld[id] == NHELD)
+    panic("lockdep: too many locks held");
+  held[id][nheld[id]].lk = lk;
+  held[id][nheld[id]].class = c;
+  held[id][nheld[id]].t0 = r_time();
+  nheld[id]++;
+}
+
+static void
+lockdep_release(void *lk)
+{
+  int id = cpuid(), i;
+  struct lockclass *c;
+  uint64 t, max;
+
+  for (i = nheld[id] - 1; i >= 0 && held[id][i].lk != lk; i--)
+    ;
+  if (i < 0)
+    panic("lockdep: release");
+  t = r_time() - held[id][i].t0;
+  if (held[id][i].class < 0)
+    c = 0;
+  else
+    c = &classes[held[id][i].class];
+  for (nheld[id]--; i < nheld[id]; i++)
+    held[id][i] = held[id][i + 1];
+
+  if (c == 0)
+    return;
+  __sync_fetch_and_add(&c->nhold, 1);
+  __sync_fetch_and_add(&c->sumhold, t);
+  while ((max = c->maxhold) < t && !__sync_bool_compare_and_swap(&c->maxhold, max, t))
+    ;
+}
+
+int statslockdep(char *buf, int sz)
+{
+  struct lockclass *c;
+  int n = 0;
+
+  n += snprintf(buf + n, sz - n, "--- lockdep: class #held avg-ticks max-ticks\n");
+  for (c = classes; c < &classes[nclasses]; c++)
+  {
+    if (c->nhold == 0)
+      continue;
+    n += snprintf(buf + n, sz - n, "%s %d %d %d\n", c->name, (int)c->nhold,
+                  (int)(c->sumhold / c->nhold), (int)c->maxhold);
+  }
+  for (int a = 0; a < nclasses; a++)
+    for (int b = 0; b < nclasses; b++)
+      if (classes[a].inverted & (1L << b))
+        n += snprintf(buf + n, sz - n, "lockdep: inversion: %s then %s, and %s then %s\n",
+                      classes[a].name, classes[b].name, classes[b].name, classes[a].name);
+  return n;
+}
 #endif
 
 void initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
   lk->locked = 0;
+  lk->mode = LK_TAS;
+  lk->ticket = 0;
+  lk->turn = 0;
   lk->cpu = 0;
+#ifdef LOCKDEP
+  lk->class = lockclass(name);
+#endif
 #ifdef LAB_LOCK
   lk->nts = 0;
   lk->n = 0;
+  memset(lk->wait, 0, sizeof(lk->wait));
+  memset(lk->hold, 0, sizeof(lk->hold));
   findslot(lk);
 #endif
 }
 
+// Choose how acquire() waits for lk. LK_TAS, the default, is
+// cheapest when the lock is rarely contended. LK_TTAS spins
+// reading the lock, which its cache line can serve locally, and
+// backs off after losing a race for it. LK_TICKET serves waiters
+// in the order they arrived, so that no hart starves on a lock
+// that all of them want. Call before anyone uses lk.
+void lockmode(struct spinlock *lk, int mode)
+{
+  lk->mode = mode;
+}
+
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 void acquire(struct spinlock *lk)
@@ -67,21 +253,56 @@ void acquire(struct spinlock *lk)
   if (holding(lk))
     panic("acquire");
 
+#ifdef LOCKDEP
+  lockdep_order(lk->class);
+#endif
 #ifdef LAB_LOCK
   __sync_fetch_and_add(&(lk->n), 1);
+  uint64 t = r_time();
 #endif
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while (__sync_lock_test_and_set(&lk->locked, 1) != 0)
+  if (lk->mode == LK_TICKET)
+  {
+    // wait for the holder of the ticket before ours to release.
+    uint ticket = __sync_fetch_and_add(&lk->ticket, 1);
+    while (__atomic_load_n(&lk->turn, __ATOMIC_ACQUIRE) != ticket)
+    {
+#ifdef LAB_LOCK
+      __sync_fetch_and_add(&(lk->nts), 1);
+#endif
+    }
+    lk->locked = 1;
+  }
+  else if (lk->mode == LK_TTAS)
+  {
+    for (int delay = 1;; delay = (delay < LOCKBACKOFF ? 2 * delay : delay))
+    {
+      while (__atomic_load_n(&lk->locked, __ATOMIC_RELAXED) != 0)
+        ;
+      if (__sync_lock_test_and_set(&lk->locked, 1) == 0)
+        break;
+#ifdef LAB_LOCK
+      __sync_fetch_and_add(&(lk->nts), 1);
+#endif
+      // another hart got there first; let the crowd thin out.
+      for (volatile int i = 0; i < delay; i++)
+        ;
+    }
+  }
+  else
   {
+    // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+    //   a5 = 1
+    //   s1 = &lk->locked
+    //   amoswap.w.aq a5, a5, (s1)
+    while (__sync_lock_test_and_set(&lk->locked, 1) != 0)
+    {
 #ifdef LAB_LOCK
-    __sync_fetch_and_add(&(lk->nts), 1);
+      __sync_fetch_and_add(&(lk->nts), 1);
 #else
-    ;
+      ;
 #endif
+    }
   }
 
   // Tell the C compiler and the processor to not move loads or stores
@@ -92,6 +313,14 @@ void acquire(struct spinlock *lk)
 
   // Record info about lock acquisition for holding() and debugging.
   lk->cpu = mycpu();
+#ifdef LAB_LOCK
+  lk->t0 = r_time();
+  // the lock protects its own histograms.
+  lockhist(lk->wait, lk->t0 - t);
+#endif
+#ifdef LOCKDEP
+  lockdep_held(lk, lk->class);
+#endif
 }
 
 // Release the lock.
@@ -100,6 +329,12 @@ void release(struct spinlock *lk)
   if (!holding(lk))
     panic("release");
 
+#ifdef LAB_LOCK
+  lockhist(lk->hold, r_time() - lk->t0);
+#endif
+#ifdef LOCKDEP
+  lockdep_release(lk);
+#endif
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -118,6 +353,8 @@ void release(struct spinlock *lk)
   //   s1 = &lk->locked
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
+  if (lk->mode == LK_TICKET)
+    __atomic_store_n(&lk->turn, lk->turn + 1, __ATOMIC_RELEASE);
 
   pop_off();
 }
@@ -131,6 +368,87 @@ int holding(struct spinlock *lk)
   return r;
 }
 
+void initrwlock(struct rwspinlock *lk, char *name)
+{
+  lk->name = name;
+  lk->state = 0;
+  lk->wwait = 0;
+  lk->cpu = 0;
+#ifdef LOCKDEP
+  lk->class = lockclass(name);
+#endif
+}
+
+// Acquire lk for reading, alongside any other readers.
+// A reader must not acquire lk again before releasing it:
+// a writer waiting in between would deadlock them both.
+void acquireread(struct rwspinlock *lk)
+{
+  uint s;
+
+  push_off();
+#ifdef LOCKDEP
+  lockdep_order(lk->class);
+#endif
+  for (;;)
+  {
+    s = __atomic_load_n(&lk->state, __ATOMIC_RELAXED);
+    if ((s & RW_WRITER) == 0 && __atomic_load_n(&lk->wwait, __ATOMIC_RELAXED) == 0 &&
+        __sync_bool_compare_and_swap(&lk->state, s, s + 1))
+      break;
+  }
+  __sync_synchronize();
+#ifdef LOCKDEP
+  lockdep_held(lk, lk->class);
+#endif
+}
+
+void releaseread(struct rwspinlock *lk)
+{
+  if ((lk->state & RW_WRITER) || lk->state == 0)
+    panic("releaseread");
+#ifdef LOCKDEP
+  lockdep_release(lk);
+#endif
+  __sync_synchronize();
+  __sync_fetch_and_sub(&lk->state, 1);
+  pop_off();
+}
+
+// Acquire lk for writing: wait for the readers to leave,
+// turning new ones away meanwhile.
+void acquirewrite(struct rwspinlock *lk)
+{
+  push_off();
+  if (lk->cpu == mycpu() && (lk->state & RW_WRITER))
+    panic("acquirewrite");
+#ifdef LOCKDEP
+  lockdep_order(lk->class);
+#endif
+  __sync_fetch_and_add(&lk->wwait, 1);
+  while (!__sync_bool_compare_and_swap(&lk->state, 0, RW_WRITER))
+    ;
+  __sync_fetch_and_sub(&lk->wwait, 1);
+  __sync_synchronize();
+  lk->cpu = mycpu();
+#ifdef LOCKDEP
+  lockdep_held(lk, lk->class);
+#endif
+}
+
+void releasewrite(struct rwspinlock *lk)
+{
+  if (lk->state != RW_WRITER || lk->cpu != mycpu())
+    panic("releasewrite");
+#ifdef LOCKDEP
+  lockdep_release(lk);
+#endif
+  lk->cpu = 0;
+  __sync_synchronize();
+  __atomic_store_n(&lk->state, 0, __ATOMIC_RELEASE);
+  pop_off();
+}
+
 // push_off/pop_off are like intr_off()/intr_on() except that they are matched:
 // it takes two pop_off()s to undo two push_off()s.  Also, if interrupts
 // are initially off, then push_off, pop_off leaves them off.
@@ -169,6 +487,23 @@ int snprint_lock(char *buf, int sz, struct spinlock *lk)
   return n;
 }
 
+static int
+snprint_hist(char *buf, int sz, struct spinlock *lk)
+{
+  int n = 0;
+
+  if (lk->n == 0)
+    return 0;
+  n += snprintf(buf + n, sz - n, "%s wait:", lk->name);
+  for (int i = 0; i < NLOCKHIST; i++)
+    n += snprintf(buf + n, sz - n, " %d", lk->wait[i]);
+  n += snprintf(buf + n, sz - n, "\n%s hold:", lk->name);
+  for (int i = 0; i < NLOCKHIST; i++)
+    n += snprintf(buf + n, sz - n, " %d", lk->hold[i]);
+  n += snprintf(buf + n, sz - n, "\n");
+  return n;
+}
+
 int statslock(char *buf, int sz)
 {
   int n;
@@ -207,6 +542,24 @@ int statslock(char *buf, int sz)
     last = locks[top]->nts;
   }
   n += snprintf(buf + n, sz - n, "tot= %d\n", tot);
+
+  // the top 5 again, with histograms of ticks spent waiting
+  // for and holding each, by powers of two.
+  n += snprintf(buf + n, sz - n, "--- wait/hold ticks: 0 1 2-3 4-7 ...\n");
+  last = 100000000;
+  for (int t = 0; t < 5; t++)
+  {
+    int top = 0;
+    for (int i = 0; i < NLOCK; i++)
+    {
+      if (locks[i] == 0)
+        break;
+      if (locks[i]->nts > locks[top]->nts && locks[i]->nts < last)
+        top = i;
+    }
+    n += snprint_hist(buf + n, sz - n, locks[top]);
+    last = locks[top]->nts;
+  }
   release(&lock_locks);
   return n;
 }
@@ -1,13 +1,48 @@
+// lock modes
+#define LK_TAS     0   // spin on test-and-set (amoswap)
+#define LK_TTAS    1   // test-and-test-and-set, backing off
+#define LK_TICKET  2   // take a ticket; served in order
+
+#define LOCKBACKOFF 1024  // most loops an LK_TTAS waiter backs off
+
+// Bucket 0 of a lock histogram counts 0 ticks of the time
+// register; bucket i counts [2^(i-1), 2^i) ticks, and the
+// last bucket everything longer.
+#define NLOCKHIST  12
+
 // Mutual exclusion lock.
 struct spinlock {
   uint locked;       // Is the lock held?
+  uint mode;         // How acquire() waits; see lockmode().
+  uint ticket;       // LK_TICKET: next ticket to hand out.
+  uint turn;         // LK_TICKET: ticket of the holder.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
 #ifdef LAB_LOCK
+  uint64 t0;               // When the holder acquired it.
   int nts;
   int n;
+  uint wait[NLOCKHIST];    // Acquires by ticks spent waiting.
+  uint hold[NLOCKHIST];    // Releases by ticks the lock was held.
+#endif
+#ifdef LOCKDEP
+  int class;               // Lock class, by name; see spinlock.c.
+#endif
+};
+
+// Reader-writer spin lock: any number of readers, or one writer.
+// A waiting writer keeps new readers out, so that a stream of
+// readers can't starve it.
+struct rwspinlock {
+  uint state;        // RW_WRITER, or the number of readers
+  uint wwait;        // writers waiting
+  char *name;        // Name of lock.
+  struct cpu *cpu;   // The cpu holding it for writing.
+#ifdef LOCKDEP
+  int class;         // Lock class, by name; see spinlock.c.
 #endif
 };
 
+#define RW_WRITER 0x80000000
@@ -9,7 +9,7 @@
 #include "riscv.h"
 #include "defs.h"
 
-#define BUFSZ 4096
+#define BUFSZ 8192
 static struct {
   struct spinlock lock;
   char buf[BUFSZ];
@@ -19,11 +19,20 @@ static struct {
 
 int statscopyin(char*, int);
 int statslock(char*, int);
+int statslockdep(char*, int);
   
+// A write is a command for the kernel counters; see kstat.c.
 int
 statswrite(int user_src, uint64 src, int n)
 {
-  return -1;
+  char cmd[64];
+
+  if(n <= 0 || n >= sizeof(cmd))
+    return -1;
+  if(either_copyin(cmd, user_src, src, n) < 0)
+    return -1;
+  cmd[n] = 0;
+  return kstatctl(cmd) < 0 ? -1 : n;
 }
 
 int
@@ -40,6 +49,10 @@ statsread(int user_dst, uint64 dst, int n)
 #ifdef LAB_LOCK
     stats.sz = statslock(stats.buf, BUFSZ);
 #endif
+#ifdef LOCKDEP
+    stats.sz += statslockdep(stats.buf + stats.sz, BUFSZ - stats.sz);
+#endif
+    stats.sz += statskstat(stats.buf + stats.sz, BUFSZ - stats.sz);
   }
   m = stats.sz - stats.off;
 
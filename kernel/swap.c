@@ -0,0 +1,330 @@
+// Swapping and memory reclaim.
+//
+// swapd, a kernel process, frees memory when free pages fall
+// below kalloc()'s low mark, or when an allocation of user memory
+// fails (see swapwait()). It first asks kernel caches to give back
+// cold pages (see kshrink() in kalloc.c); if that is not enough,
+// it writes user pages that have not been used lately to the swap
+// area, which follows the file system on the disk (see mkfs), and
+// frees them.
+// The PTE of a page in swap is not valid, but has PTE_SWAP set and
+// holds the page's swap slot; when the process touches the page
+// again, vmfault() calls swapin() to read it back.
+//
+// swapd picks pages with the CLOCK algorithm. Its hand sweeps the
+// user pages of each address space in turn, using the PTE_A bit
+// that the hardware sets in a page's PTE when the page is used: a
+// page with the bit set has it cleared and gets another chance,
+// and a page whose bit is still clear when the hand comes round
+// again goes to swap.
+//
+// Only writable 4096-byte pages go to swap. Megapages and shared
+// memory stay in memory. Program text that the hand finds unused is unmapped
+// rather than written out, since vmfault() can map it again from
+// the text cache; once no page table maps a text page, the text
+// cache's shrinker can free it.
+//
+// swapd freezes a thread group while it takes pages from the
+// group's address space (see tgfreeze() in proc.c), so no thread
+// can use or change a page, or hold a TLB entry for it, while the
+// page is on its way to disk.
+//
+// A child forked from a process with pages in swap shares their
+// slots, so each slot counts the page tables that refer to it.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+
+#define SLOTBLOCKS (PGSIZE / BSIZE)
+#define NSLOT      (SWAPSIZE / SLOTBLOCKS)
+#define SWAPBATCH  64   // pages swapd tries to free per request
+
+struct {
+  struct spinlock lock;
+  uchar ref[NSLOT];   // page tables referring to each slot
+  int next;           // where the search for a free slot resumes
+
+  int want;           // swapwait() asks swapd for a pass
+  int low;            // swapkick() does
+  int running;        // swapd is in a pass
+  int passes;         // passes swapd has finished
+  int freed;          // pages its last pass freed
+
+  // the CLOCK hand; only swapd uses these.
+  int group;          // index in tgroups[]
+  uint64 va;          // next user address to look at in it
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+}
+
+// Allocate a swap slot. Returns -1 if swap is full.
+static int
+slotalloc(void)
+{
+  int slot = -1;
+
+  acquire(&swap.lock);
+  for(int i = 0; i < NSLOT; i++){
+    if(swap.ref[swap.next] == 0){
+      slot = swap.next;
+      swap.ref[slot] = 1;
+      break;
+    }
+    swap.next = (swap.next + 1) % NSLOT;
+  }
+  release(&swap.lock);
+  return slot;
+}
+
+// Another page table refers to slot; see uvmcopy().
+void
+swapdup(uint64 slot)
+{
+  acquire(&swap.lock);
+  if(slot >= NSLOT || swap.ref[slot] == 0)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// A page table no longer refers to slot.
+void
+swapput(uint64 slot)
+{
+  acquire(&swap.lock);
+  if(slot >= NSLOT || swap.ref[slot] == 0)
+    panic("swapput");
+  swap.ref[slot]--;
+  release(&swap.lock);
+}
+
+static void
+slotrw(uint64 slot, void *pa, int write)
+{
+  virtio_disk_rwpage(FSSIZE + slot*SLOTBLOCKS, pa, write);
+}
+
+// Read p's page at va back from swap, if it is there, for an
+// access that needs perm. Returns 0 if the access may be retried,
+// -1 if it is bad or there is no memory, and 1 if va is not in swap.
+int
+swapin(struct proc *p, uint64 va, int perm)
+{
+  struct tgroup *tg = p->tg;
+  struct ptcursor c;
+  pte_t *pte, old;
+  uint64 sz;
+  char *mem;
+
+  cursorinit(&c, p->pagetable);
+  acquire(&tg->lock);
+  pte = cursorwalk(&c, va, 0, &sz);
+  old = pte ? *pte : 0;
+  release(&tg->lock);
+  if(old & PTE_V)
+    return 0;   // another thread read it in.
+  if((old & PTE_SWAP) == 0)
+    return 1;
+  if((perm & ~PTE_FLAGS(old)) != 0)
+    return -1;
+
+  while((mem = kalloc()) == 0)
+    if(swapwait() < 0)
+      return -1;
+  slotrw(PTE2SLOT(old), mem, 0);
+
+  // the page-table page can't go away, since p still uses the
+  // address space; but another thread may have read the page in,
+  // or unmapped it, while this one slept.
+  acquire(&tg->lock);
+  if(*pte == old){
+    *pte = PA2PTE(mem) | (PTE_FLAGS(old) & ~PTE_SWAP) | PTE_V | PTE_A | PTE_D;
+    swapput(PTE2SLOT(old));
+    mem = 0;
+  }
+  release(&tg->lock);
+  if(mem)
+    kfree(mem);
+  return 0;
+}
+
+// Sweep the hand over the frozen address space of p's group,
+// from swap.va on, freeing up to n pages. Returns the number
+// freed, or -1 if swap is full and none were.
+static int
+sweep(struct proc *p, int n)
+{
+  struct tgroup *tg = p->tg;
+  struct ptcursor c;
+  pte_t *pte, old;
+  uint64 sz, pa;
+  int slot, sent = 0;
+
+  cursorinit(&c, p->pagetable);
+  for(; swap.va < p->sz && sent < n; swap.va += sz){
+    acquire(&tg->lock);
+    if((pte = cursorwalk(&c, swap.va, 0, &sz)) == 0){
+      release(&tg->lock);
+      sz = MEGAPGSIZE - swap.va % MEGAPGSIZE;
+      continue;
+    }
+    old = *pte;
+    if(sz != PGSIZE || (old & (PTE_V|PTE_U)) != (PTE_V|PTE_U) ||
+       (old & PTE_SHARED)){
+      release(&tg->lock);
+      continue;
+    }
+    if(old & PTE_A){
+      *pte = old & ~PTE_A;
+      release(&tg->lock);
+      continue;
+    }
+    pa = PTE2PA(old);
+    if((old & PTE_W) == 0){
+      // program text: just let go of it.
+      if(tg->text.ip && swap.va >= tg->text.va && swap.va < tg->text.end){
+        *pte = 0;
+        if(krefs((void*)pa) == 1)
+          sent++;
+        kfree((void*)pa);
+      }
+      release(&tg->lock);
+      continue;
+    }
+    release(&tg->lock);
+
+    if(futexbusy(pa))
+      continue;
+    if((slot = slotalloc()) < 0){
+      sent = sent ? sent : -1;
+      break;
+    }
+    slotrw(slot, (void*)pa, 1);
+    acquire(&tg->lock);
+    *pte = SLOT2PTE(slot) | (PTE_FLAGS(old) & (PTE_R|PTE_W|PTE_X|PTE_U)) | PTE_SWAP;
+    release(&tg->lock);
+    kfree((void*)pa);
+    sent++;
+  }
+  // the TLBs must forget both the pages sent to swap and the
+  // PTE_A bits that were cleared, or the hardware won't set
+  // those again when the pages are used.
+  asidflush(tg);
+  return sent;
+}
+
+// Move the hand on until n pages have gone to swap, or it has
+// been twice round every address space. Returns the number freed.
+static int
+reclaim(int n)
+{
+  struct proc *p;
+  int r, freed = 0;
+
+  for(int visits = 0; freed < n && visits <= 2*NPROC; visits++){
+    if((p = tgfreeze(&tgroups[swap.group])) != 0){
+      r = sweep(p, n - freed);
+      tgthaw(&tgroups[swap.group]);
+      if(r < 0)
+        break;
+      freed += r;
+      if(freed >= n)
+        break;
+    }
+    swap.group = (swap.group + 1) % NPROC;
+    swap.va = 0;
+  }
+  return freed;
+}
+
+// Free pages until kalloc() is back above its high mark,
+// and at least min of them: cold cache pages first, then
+// user pages. Returns the number freed.
+static int
+memreclaim(int min)
+{
+  int need, n;
+
+  need = NCPU*KMEMHIGH - kfreepages();
+  if(need < min)
+    need = min;
+  if(need <= 0)
+    return 0;
+  n = kshrink(need);
+  if(n < need)
+    n += reclaim(need - n);
+  return n;
+}
+
+// swapd's body; kproc() starts it. Frees memory whenever
+// swapwait() or swapkick() asks it to.
+void
+swapd(void)
+{
+  int min, n;
+
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
+
+  acquire(&swap.lock);
+  for(;;){
+    while(swap.want == 0 && swap.low == 0)
+      sleep(&swap.want, &swap.lock);
+    min = swap.want ? SWAPBATCH : 0;
+    swap.want = 0;
+    swap.low = 0;
+    swap.running = 1;
+    release(&swap.lock);
+
+    n = memreclaim(min);
+
+    acquire(&swap.lock);
+    swap.running = 0;
+    swap.freed = n;
+    swap.passes++;
+    wakeup(&swap.passes);
+  }
+}
+
+// Out of memory for user pages: have swapd free some, and wait
+// for it. Returns 0 if it did, -1 if it found nothing to swap.
+// The caller must hold no spinlocks.
+int
+swapwait(void)
+{
+  int done, r;
+
+  acquire(&swap.lock);
+  // a pass already under way may have gone by the caller's
+  // pages before it began to wait, so wait for the next one.
+  done = swap.passes + 1 + swap.running;
+  swap.want = 1;
+  wakeup(&swap.want);
+  while(swap.passes < done && !myproc()->killed)
+    sleep(&swap.passes, &swap.lock);
+  r = (swap.passes >= done && swap.freed > 0) ? 0 : -1;
+  release(&swap.lock);
+  return r;
+}
+
+// Free memory has fallen below kalloc()'s low mark: have swapd
+// bring it back up. Called from the clock interrupt.
+void
+swapkick(void)
+{
+  acquire(&swap.lock);
+  swap.low = 1;
+  wakeup(&swap.want);
+  release(&swap.lock);
+}
@@ -3,8 +3,15 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "syscall.h"
+#include "batch.h"
+#include "kstat.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "systrace.h"
 #include "defs.h"
 
 // Fetch the uint64 at addr from the current process.
@@ -104,6 +111,28 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_wait(void);
 extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_shmat(void);
+extern uint64 sys_shmdt(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_pipesize(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_ioring_setup(void);
+extern uint64 sys_ioring_enter(void);
+extern uint64 sys_syscall_batch(void);
+extern uint64 sys_systrace(void);
+extern uint64 sys_syslat(void);
+extern uint64 sys_wait2(void);
+extern uint64 sys_procinfo(void);
+extern uint64 sys_nanosleep(void);
+extern uint64 sys_nanotime(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -127,8 +156,181 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_splice]  sys_splice,
+[SYS_pipesize] sys_pipesize,
+[SYS_poll]    sys_poll,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_ioring_setup] sys_ioring_setup,
+[SYS_ioring_enter] sys_ioring_enter,
+[SYS_syscall_batch] sys_syscall_batch,
+[SYS_systrace] sys_systrace,
+[SYS_syslat]   sys_syslat,
+[SYS_wait2]    sys_wait2,
+[SYS_procinfo] sys_procinfo,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_nanotime] sys_nanotime,
 };
 
+// names for counters and traces.
+static char *syscallnames[] = {
+[SYS_fork]          "fork",
+[SYS_exit]          "exit",
+[SYS_wait]          "wait",
+[SYS_pipe]          "pipe",
+[SYS_read]          "read",
+[SYS_kill]          "kill",
+[SYS_exec]          "exec",
+[SYS_fstat]         "fstat",
+[SYS_chdir]         "chdir",
+[SYS_dup]           "dup",
+[SYS_getpid]        "getpid",
+[SYS_sbrk]          "sbrk",
+[SYS_sleep]         "sleep",
+[SYS_uptime]        "uptime",
+[SYS_open]          "open",
+[SYS_write]         "write",
+[SYS_mknod]         "mknod",
+[SYS_unlink]        "unlink",
+[SYS_link]          "link",
+[SYS_mkdir]         "mkdir",
+[SYS_close]         "close",
+[SYS_clone]         "clone",
+[SYS_join]          "join",
+[SYS_futex_wait]    "futex_wait",
+[SYS_futex_wake]    "futex_wake",
+[SYS_shmat]         "shmat",
+[SYS_shmdt]         "shmdt",
+[SYS_splice]        "splice",
+[SYS_pipesize]      "pipesize",
+[SYS_poll]          "poll",
+[SYS_readv]         "readv",
+[SYS_writev]        "writev",
+[SYS_pread]         "pread",
+[SYS_pwrite]        "pwrite",
+[SYS_ioring_setup]  "ioring_setup",
+[SYS_ioring_enter]  "ioring_enter",
+[SYS_syscall_batch] "syscall_batch",
+[SYS_systrace]      "systrace",
+[SYS_syslat]        "syslat",
+[SYS_wait2]         "wait2",
+[SYS_procinfo]      "procinfo",
+[SYS_nanosleep]     "nanosleep",
+[SYS_nanotime]      "nanotime",
+};
+
+char*
+syscallname(int num)
+{
+  if(num <= 0 || num >= NELEM(syscallnames) || syscallnames[num] == 0)
+    return 0;
+  return syscallnames[num];
+}
+
+// System calls that processes have asked to trace, most
+// recent last, for the systrace device. A reader that falls
+// behind loses the oldest.
+#define NSYSEVENT 256
+
+static struct {
+  struct spinlock lock;
+  struct sysevent ev[NSYSEVENT];
+  uint64 head;     // events recorded
+  uint64 tail;     // events read
+} systrace;
+
+static int systraceread(int, uint64, int);
+
+void
+systraceinit(void)
+{
+  initlock(&systrace.lock, "systrace");
+  devsw[SYSTRACE].read = systraceread;
+}
+
+static void
+systraceadd(struct proc *p, int num, uint64 *args, uint64 ret, uint64 t)
+{
+  struct sysevent *e;
+
+  acquire(&systrace.lock);
+  e = &systrace.ev[systrace.head++ % NSYSEVENT];
+  e->time = r_time();
+  e->ticks = t;
+  memmove(e->args, args, sizeof(e->args));
+  e->ret = ret;
+  e->pid = p->pid;
+  e->num = num;
+  e->cpu = cpuid();
+  safestrcpy(e->name, syscallnames[num], sizeof(e->name));
+  release(&systrace.lock);
+}
+
+// Copy out as many whole events as fit in n bytes, oldest first.
+// Returns -1 if dst is bad.
+static int
+systraceread(int user_dst, uint64 dst, int n)
+{
+  struct sysevent e;
+  int tot = 0;
+
+  // fault the destination in first, as ktraceread() does.
+  if(user_dst)
+    vmtouch(dst, n, PTE_W);
+  acquire(&systrace.lock);
+  while(tot + sizeof(e) <= n){
+    if(systrace.head - systrace.tail > NSYSEVENT)
+      systrace.tail = systrace.head - NSYSEVENT;
+    if(systrace.tail >= systrace.head)
+      break;
+    e = systrace.ev[systrace.tail % NSYSEVENT];
+    if(either_copyout(user_dst, dst + tot, &e, sizeof(e)) < 0){
+      if(user_dst && (vmretry(dst + tot, PTE_W, &systrace.lock) == 0 ||
+                      vmretry(dst + tot + sizeof(e) - 1, PTE_W, &systrace.lock) == 0))
+        continue;   // lock was let go: look at the ring again
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    systrace.tail++;
+    tot += sizeof(e);
+  }
+  release(&systrace.lock);
+  return tot;
+}
+
+// Make system call num for p, which the caller has checked,
+// counting it in p's latency histogram, and tracing it if p
+// asked to. Returns its result.
+static uint64
+dosyscall(struct proc *p, int num)
+{
+  struct trapframe *tf = p->trapframe;
+  uint64 args[6] = { tf->a0, tf->a1, tf->a2, tf->a3, tf->a4, tf->a5 };
+  uint64 t, ret;
+  int i;
+
+  kstat(KS_SYSCALL + num, num);
+  t = r_time();
+  ret = syscalls[num]();
+  t = r_time() - t;
+  for(i = 0; i < NSYSHIST - 1 && (t >> i) != 0; i++)
+    ;
+  if(num < NSYSLAT)
+    p->syslat[num][i]++;
+  if(num < 64 && (p->tracemask & (1L << num)))
+    systraceadd(p, num, args, ret, t);
+  return ret;
+}
+
 void
 syscall(void)
 {
@@ -137,10 +339,100 @@ syscall(void)
 
   num = p->trapframe->a7;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
-    p->trapframe->a0 = syscalls[num]();
+    p->trapframe->a0 = dosyscall(p, num);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
     p->trapframe->a0 = -1;
   }
 }
+
+// Make the n system calls described by the struct sysrecs at
+// user address a0, one after another, in a single trap, storing
+// each one's return value in its record. Stops after a call that
+// returns -1. Calls that replace or copy the caller's registers,
+// or never return, can't be batched. Returns the number of calls
+// made, or -1.
+uint64
+sys_syscall_batch(void)
+{
+  struct proc *p = myproc();
+  struct trapframe *tf = p->trapframe;
+  uint64 base, addr, saved[6], ret;
+  struct sysrec r;
+  int i, n;
+
+  if(argaddr(0, &base) < 0 || argint(1, &n) < 0 || n < 0 || n > MAXBATCH)
+    return -1;
+
+  saved[0] = tf->a0; saved[1] = tf->a1; saved[2] = tf->a2;
+  saved[3] = tf->a3; saved[4] = tf->a4; saved[5] = tf->a5;
+  for(i = 0, addr = base; i < n; i++, addr += sizeof(r)){
+    if(copyin(p->pagetable, (char*)&r, addr, sizeof(r)) < 0)
+      break;
+    if(r.arg0from >= i)
+      break;
+    // an earlier result is read back from its record, where
+    // it was stored, rather than kept on the kernel stack.
+    if(r.arg0from >= 0 &&
+       copyin(p->pagetable, (char*)&r.args[0],
+              (uint64)&((struct sysrec*)base)[r.arg0from].ret,
+              sizeof(r.args[0])) < 0)
+      break;
+    if(r.num <= 0 || r.num >= NELEM(syscalls) || syscalls[r.num] == 0 ||
+       r.num == SYS_fork || r.num == SYS_exec || r.num == SYS_exit ||
+       r.num == SYS_clone || r.num == SYS_syscall_batch){
+      ret = -1;
+    } else {
+      tf->a0 = r.args[0]; tf->a1 = r.args[1]; tf->a2 = r.args[2];
+      tf->a3 = r.args[3]; tf->a4 = r.args[4]; tf->a5 = r.args[5];
+      ret = dosyscall(p, r.num);
+    }
+    if(copyout(p->pagetable, (uint64)&((struct sysrec*)addr)->ret,
+               (char*)&ret, sizeof(ret)) < 0)
+      break;
+    if(ret == -1){
+      i++;
+      break;
+    }
+  }
+  tf->a0 = saved[0]; tf->a1 = saved[1]; tf->a2 = saved[2];
+  tf->a3 = saved[3]; tf->a4 = saved[4]; tf->a5 = saved[5];
+  return i;
+}
+
+// Trace the system calls whose bits are set in mask a0, in the
+// caller and the children it forks from now on. Returns the
+// mask that was set before.
+uint64
+sys_systrace(void)
+{
+  struct proc *p = myproc();
+  uint64 mask, old = p->tracemask;
+
+  if(argaddr(0, &mask) < 0)
+    return -1;
+  p->tracemask = mask;
+  return old;
+}
+
+// Copy process a0's latency histogram for system call a1 to user
+// address a2: NSYSHIST counts, of calls taking 0 ticks of the time
+// register, then [2^(i-1), 2^i) ticks for each i, the last taking
+// longer. Process 0 is the caller.
+uint64
+sys_syslat(void)
+{
+  struct proc *p = myproc();
+  uint hist[NSYSHIST];
+  uint64 addr;
+  int pid, num;
+
+  if(argint(0, &pid) < 0 || argint(1, &num) < 0 || argaddr(2, &addr) < 0)
+    return -1;
+  if(num <= 0 || num >= NSYSLAT)
+    return -1;
+  if(syslatcopy(pid ? pid : p->pid, num, hist) < 0)
+    return -1;
+  return copyout(p->pagetable, addr, (char*)hist, sizeof(hist));
+}
@@ -20,3 +20,25 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_clone  22
+#define SYS_join   23
+#define SYS_futex_wait 24
+#define SYS_futex_wake 25
+#define SYS_shmat  26
+#define SYS_shmdt  27
+#define SYS_splice 28
+#define SYS_pipesize 29
+#define SYS_poll   30
+#define SYS_readv  31
+#define SYS_writev 32
+#define SYS_pread  33
+#define SYS_pwrite 34
+#define SYS_ioring_setup 35
+#define SYS_ioring_enter 36
+#define SYS_syscall_batch 37
+#define SYS_systrace 38
+#define SYS_syslat 39
+#define SYS_wait2  40
+#define SYS_procinfo 41
+#define SYS_nanosleep 42
+#define SYS_nanotime 43
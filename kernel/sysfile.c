@@ -10,28 +10,42 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+
+// The file open as the current process's descriptor fd, with a
+// reference of the caller's own, which it must fileclose(); or 0.
+// The other threads in the group may close fd meanwhile.
+struct file*
+fdget(int fd)
+{
+  struct tgroup *tg = myproc()->tg;
+  struct file *f = 0;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquire(&tg->lock);
+  if(tg->ofile[fd])
+    f = filedup(tg->ofile[fd]);
+  release(&tg->lock);
+  return f;
+}
 
 // Fetch the nth word-sized system call argument as a file descriptor
-// and return both the descriptor and the corresponding struct file.
+// and return the corresponding struct file, with a reference that
+// the caller must fileclose(), as fdget() does.
 static int
-argfd(int n, int *pfd, struct file **pf)
+argfd(int n, struct file **pf)
 {
   int fd;
-  struct file *f;
 
-  if(argint(n, &fd) < 0)
-    return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(argint(n, &fd) < 0 || (*pf = fdget(fd)) == 0)
     return -1;
-  if(pfd)
-    *pfd = fd;
-  if(pf)
-    *pf = f;
   return 0;
 }
 
@@ -41,14 +55,17 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct tgroup *tg = myproc()->tg;
 
+  acquire(&tg->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd] == 0){
-      p->ofile[fd] = f;
+    if(tg->ofile[fd] == 0){
+      tg->ofile[fd] = f;
+      release(&tg->lock);
       return fd;
     }
   }
+  release(&tg->lock);
   return -1;
 }
 
@@ -58,11 +75,13 @@ sys_dup(void)
   struct file *f;
   int fd;
 
-  if(argfd(0, 0, &f) < 0)
+  if(argfd(0, &f) < 0)
     return -1;
-  if((fd=fdalloc(f)) < 0)
+  // the new descriptor takes argfd()'s reference.
+  if((fd=fdalloc(f)) < 0){
+    fileclose(f);
     return -1;
-  filedup(f);
+  }
   return fd;
 }
 
@@ -70,49 +89,151 @@ uint64
 sys_read(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  r = fileread(f, p, n);
+  fileclose(f);
+  return r;
 }
 
 uint64
 sys_write(void)
 {
   struct file *f;
-  int n;
+  int n, r;
   uint64 p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argaddr(1, &p) < 0)
+  if(argint(2, &n) < 0 || argaddr(1, &p) < 0 || argfd(0, &f) < 0)
     return -1;
+  r = filewrite(f, p, n);
+  fileclose(f);
+  return r;
+}
 
-  return filewrite(f, p, n);
+// Fetch the syscall's array of n struct iovecs at
+// argument a into iov.
+static int
+argiov(int a, int n, struct iovec *iov)
+{
+  uint64 addr;
+
+  if(argaddr(a, &addr) < 0 || n < 0 || n > MAXIOV)
+    return -1;
+  return copyin(myproc()->pagetable, (char*)iov, addr, n*sizeof(iov[0]));
 }
 
 uint64
-sys_close(void)
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int n, r;
+
+  if(argint(2, &n) < 0 || argiov(1, n, iov) < 0 || argfd(0, &f) < 0)
+    return -1;
+  r = filereadv(f, iov, n, -1);
+  fileclose(f);
+  return r;
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int n, r;
+
+  if(argint(2, &n) < 0 || argiov(1, n, iov) < 0 || argfd(0, &f) < 0)
+    return -1;
+  r = filewritev(f, iov, n, -1);
+  fileclose(f);
+  return r;
+}
+
+// read() at an offset, which must not be negative,
+// leaving the file's own offset alone.
+uint64
+sys_pread(void)
 {
-  int fd;
   struct file *f;
+  struct iovec iov;
+  int n, off, r;
+  uint64 p;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0 || off < 0 || argfd(0, &f) < 0)
+    return -1;
+  iov.base = (void*)p;
+  iov.len = n;
+  r = filereadv(f, &iov, 1, off);
+  fileclose(f);
+  return r;
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off, r;
+  uint64 p;
+
+  if(argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0 || off < 0 || argfd(0, &f) < 0)
+    return -1;
+  iov.base = (void*)p;
+  iov.len = n;
+  r = filewritev(f, &iov, 1, off);
+  fileclose(f);
+  return r;
+}
+
+// Close the current process's file descriptor fd.
+int
+fdclose(int fd)
+{
+  struct tgroup *tg = myproc()->tg;
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return -1;
+  // of threads closing fd at once, the one that
+  // empties the slot closes the file.
+  acquire(&tg->lock);
+  f = tg->ofile[fd];
+  tg->ofile[fd] = 0;
+  release(&tg->lock);
+  if(f == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
 
+uint64
+sys_close(void)
+{
+  int fd;
+
+  if(argint(0, &fd) < 0)
+    return -1;
+  return fdclose(fd);
+}
+
 uint64
 sys_fstat(void)
 {
   struct file *f;
   uint64 st; // user pointer to struct stat
+  int r;
 
-  if(argfd(0, 0, &f) < 0 || argaddr(1, &st) < 0)
+  if(argaddr(1, &st) < 0 || argfd(0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  r = filestat(f, st);
+  fileclose(f);
+  return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -283,17 +404,14 @@ create(char *path, short type, short major, short minor)
   return ip;
 }
 
-uint64
-sys_open(void)
+// Open path for the current process, as open() does.
+// Returns the new file descriptor, or -1.
+int
+fileopen(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
-    return -1;
 
   begin_op();
 
@@ -351,6 +469,17 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
+    return -1;
+  return fileopen(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -469,18 +598,85 @@ sys_pipe(void)
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
     if(fd0 >= 0)
-      p->ofile[fd0] = 0;
-    fileclose(rf);
+      fdclose(fd0);
+    else
+      fileclose(rf);
     fileclose(wf);
     return -1;
   }
   if(copyout(p->pagetable, fdarray, (char*)&fd0, sizeof(fd0)) < 0 ||
      copyout(p->pagetable, fdarray+sizeof(fd0), (char *)&fd1, sizeof(fd1)) < 0){
-    p->ofile[fd0] = 0;
-    p->ofile[fd1] = 0;
-    fileclose(rf);
-    fileclose(wf);
+    fdclose(fd0);
+    fdclose(fd1);
     return -1;
   }
   return 0;
 }
+
+// Move up to n bytes between a pipe and a file
+// without copying them through user memory.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n, r;
+
+  if(argint(2, &n) < 0 || argfd(0, &in) < 0)
+    return -1;
+  if(argfd(1, &out) < 0){
+    fileclose(in);
+    return -1;
+  }
+  r = filesplice(in, out, n);
+  fileclose(in);
+  fileclose(out);
+  return r;
+}
+
+// Resize the buffer of the pipe fd refers to, or report
+// its size if the new size is 0.
+uint64
+sys_pipesize(void)
+{
+  struct file *f;
+  int n, r = -1;
+
+  if(argint(1, &n) < 0 || argfd(0, &f) < 0)
+    return -1;
+  if(f->type == FD_PIPE)
+    r = pipesize(f->pipe, n);
+  fileclose(f);
+  return r;
+}
+
+// Wait for any of an array of struct pollfd to be ready,
+// or for a timeout in ticks.
+uint64
+sys_poll(void)
+{
+  uint64 fds;
+  int nfds, timeout;
+
+  if(argaddr(0, &fds) < 0 || argint(1, &nfds) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  return poll(fds, nfds, timeout);
+}
+
+// Map an asynchronous I/O ring into the process.
+uint64
+sys_ioring_setup(void)
+{
+  return ioringsetup();
+}
+
+// Submit what is on the process's I/O ring, and wait
+// for a number of completions.
+uint64
+sys_ioring_enter(void)
+{
+  int wait;
+
+  if(argint(0, &wait) < 0)
+    return -1;
+  return ioringenter(wait);
+}
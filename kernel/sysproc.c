@@ -5,6 +5,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 
 uint64
@@ -38,6 +39,90 @@ sys_wait(void)
   return wait(p);
 }
 
+uint64
+sys_wait2(void)
+{
+  uint64 p, ru;
+
+  if(argaddr(0, &p) < 0 || argaddr(1, &ru) < 0)
+    return -1;
+  return wait2(p, ru);
+}
+
+uint64
+sys_procinfo(void)
+{
+  uint64 p;
+  int n;
+
+  if(argaddr(0, &p) < 0 || argint(1, &n) < 0)
+    return -1;
+  return procinfo(p, n);
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &p) < 0)
+    return -1;
+  return join(tid, p);
+}
+
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
+
+uint64
+sys_shmat(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0)
+    return -1;
+  return shmat(key, size);
+}
+
+uint64
+sys_shmdt(void)
+{
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  return shmdt(addr);
+}
+
 uint64
 sys_sbrk(void)
 {
@@ -57,22 +142,44 @@ sys_sleep(void)
 {
   int n;
   uint ticks0;
+  uint64 deadline;
 
   if(argint(0, &n) < 0)
     return -1;
   acquire(&tickslock);
   ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
+  release(&tickslock);
+  // sleep on a timer rather than on ticks, so that the clock
+  // interrupt need not wake every sleeper. ticks can fall a
+  // little behind the time register; wait for them in short
+  // naps after the first.
+  deadline = r_time() + (uint64)n * TICKCYCLES;
+  while(n > 0 && (int)(ticks - ticks0) < n){
+    if(timersleep(deadline) < 0)
       return -1;
-    }
-    sleep(&ticks, &tickslock);
+    deadline = r_time() + TICKCYCLES / 8;
   }
-  release(&tickslock);
   return 0;
 }
 
+// Sleep for a0 nanoseconds.
+uint64
+sys_nanosleep(void)
+{
+  uint64 ns;
+
+  if(argaddr(0, &ns) < 0)
+    return -1;
+  return timersleep(r_time() + (ns + 1000000000/TIMEFREQ - 1) / (1000000000/TIMEFREQ));
+}
+
+// Nanoseconds since boot.
+uint64
+sys_nanotime(void)
+{
+  return r_time() * (1000000000 / TIMEFREQ);
+}
+
 uint64
 sys_kill(void)
 {
@@ -0,0 +1,12 @@
+// A traced system call, as reading the systrace device
+// returns it; see syscall.c.
+struct sysevent {
+  uint64 time;      // time register when it returned
+  uint64 ticks;     // time register ticks it took
+  uint64 args[6];
+  uint64 ret;
+  uint pid;
+  ushort num;
+  ushort cpu;
+  char name[16];    // the system call's
+};
@@ -0,0 +1,178 @@
+// Timers, for sleeps that end at a precise time rather than
+// at a clock tick.
+//
+// A sleeping process puts a struct timer on the wheel of the
+// CPU it is running on: NWHEEL slots, each holding the timers
+// whose deadlines fall in one WHEELRES-cycle span of the time
+// register, modulo the wheel's revolution. The CPU hands its
+// earliest deadline to timervec in kernelvec.S, which sets the
+// CLINT to interrupt at that deadline or at the end of the clock
+// tick's interval, whichever comes first. The software interrupt
+// that timervec raises comes to timerintr(), which expires the
+// due timers and wakes just their sleepers.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "defs.h"
+
+#define NWHEEL    256
+#define WHEELRES  256     // cycles a slot spans; about 25us in qemu
+
+extern uint64 timer_scratch[NCPU][8];
+
+// a sleeping process's timer; lives on its kernel stack.
+struct timer {
+  uint64 deadline;
+  struct timer *next;   // in its slot
+  int fired;
+};
+
+static struct wheel {
+  struct spinlock lock;
+  struct timer *slot[NWHEEL];
+  int n;                // timers on the wheel
+  uint64 done;          // expired up to this slot's span
+  uint64 next;          // deadline given to timervec; -1 if none
+} wheels[NCPU];
+
+void
+timersinit(void)
+{
+  for(int i = 0; i < NCPU; i++){
+    initlock(&wheels[i].lock, "wheel");
+    wheels[i].next = -1;
+  }
+}
+
+// Have this CPU's timer interrupt at deadline, or at the
+// end of the current interval if that is sooner.
+// Interrupts must be off.
+static void
+settimer(uint64 deadline)
+{
+  timer_scratch[cpuid()][6] = deadline;
+  asm volatile("ecall" : : : "memory");
+}
+
+// The earliest deadline on w, or -1 if none.
+static uint64
+earliest(struct wheel *w)
+{
+  uint64 best = -1, s;
+  struct timer *t;
+
+  if(w->n == 0)
+    return best;
+  // the slots in time order; every timer is at or after done.
+  for(s = w->done; s < w->done + NWHEEL; s++){
+    for(t = w->slot[s % NWHEEL]; t; t = t->next)
+      if(t->deadline / WHEELRES == s && t->deadline < best)
+        best = t->deadline;
+    if(best != -1)
+      return best;
+  }
+  // every timer is more than a revolution away.
+  for(s = 0; s < NWHEEL; s++)
+    for(t = w->slot[s]; t; t = t->next)
+      if(t->deadline < best)
+        best = t->deadline;
+  return best;
+}
+
+static void
+unlink(struct wheel *w, struct timer *t)
+{
+  struct timer **tp;
+
+  for(tp = &w->slot[(t->deadline / WHEELRES) % NWHEEL]; *tp; tp = &(*tp)->next){
+    if(*tp == t){
+      *tp = t->next;
+      w->n--;
+      return;
+    }
+  }
+}
+
+// Sleep until the time register reaches deadline.
+// Returns -1 if killed first.
+int
+timersleep(uint64 deadline)
+{
+  struct proc *p = myproc();
+  struct wheel *w;
+  struct timer t;
+  struct timer **tp;
+
+  push_off();
+  w = &wheels[cpuid()];
+  acquire(&w->lock);
+  pop_off();
+
+  if(deadline <= r_time()){
+    release(&w->lock);
+    return 0;
+  }
+  t.deadline = deadline;
+  t.fired = 0;
+  tp = &w->slot[(deadline / WHEELRES) % NWHEEL];
+  t.next = *tp;
+  *tp = &t;
+  w->n++;
+  // holding w->lock keeps this process on w's CPU.
+  if(deadline < w->next){
+    w->next = deadline;
+    settimer(deadline);
+  }
+
+  while(!t.fired){
+    if(p->killed){
+      unlink(w, &t);
+      release(&w->lock);
+      return -1;
+    }
+    sleep(&t, &w->lock);
+  }
+  release(&w->lock);
+  return 0;
+}
+
+// A software interrupt from timervec: wake the sleepers whose
+// deadlines have come, and return how many intervals have ended
+// since the last call. Interrupts must be off.
+int
+timerintr(void)
+{
+  int id = cpuid();
+  struct wheel *w = &wheels[id];
+  struct timer *t, **tp;
+  uint64 now, s, end;
+
+  // only this CPU, with interrupts off, sets w->next.
+  if(w->next <= r_time()){
+    acquire(&w->lock);
+    now = r_time();
+    end = now / WHEELRES;
+    for(s = w->done; s <= end && s < w->done + NWHEEL; s++){
+      for(tp = &w->slot[s % NWHEEL]; (t = *tp) != 0; ){
+        if(t->deadline <= now){
+          *tp = t->next;
+          w->n--;
+          t->fired = 1;
+          wakeup(t);
+        } else {
+          tp = &t->next;
+        }
+      }
+    }
+    w->done = end;
+    w->next = earliest(w);
+    settimer(w->next);
+    release(&w->lock);
+  }
+
+  return __atomic_exchange_n(&timer_scratch[id][7], 0, __ATOMIC_RELAXED);
+}
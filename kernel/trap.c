@@ -3,6 +3,7 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "rusage.h"
 #include "proc.h"
 #include "defs.h"
 
@@ -10,6 +11,7 @@ struct spinlock tickslock;
 uint ticks;
 
 extern char trampoline[], uservec[], userret[];
+extern char ucopybegin[], ucopyend[], ucopyfault[]; // usercopy.S
 
 // in kernelvec.S, calls kerneltrap().
 void kernelvec();
@@ -20,6 +22,7 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  lockmode(&tickslock, LK_TICKET);
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -29,6 +32,19 @@ trapinithart(void)
   w_stvec((uint64)kernelvec);
 }
 
+// the permission a page fault with this scause needed,
+// or 0 if scause is not a page fault.
+static int
+faultperm(uint64 scause)
+{
+  switch(scause){
+  case 12: return PTE_X;   // instruction page fault
+  case 13: return PTE_R;   // load page fault
+  case 15: return PTE_W;   // store/AMO page fault
+  }
+  return 0;
+}
+
 //
 // handle an interrupt, exception, or system call from user space.
 // called from trampoline.S
@@ -67,6 +83,12 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(faultperm(r_scause()) &&
+            vmfault(p, r_stval(), faultperm(r_scause())) == 0){
+    // a text page or a page from swap is now mapped, or was
+    // already and this hart's TLB held an old translation;
+    // flush and retry.
+    sfence_vma();
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -77,8 +99,11 @@ usertrap(void)
     exit(-1);
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2)
+  if(which_dev == 2){
+    p->ru.utime++;
+    p->ru.nivcsw++;
     yield();
+  }
 
   usertrapret();
 }
@@ -99,9 +124,13 @@ usertrapret(void)
   // send syscalls, interrupts, and exceptions to trampoline.S
   w_stvec(TRAMPOLINE + (uservec - trampoline));
 
+  // the user page table to switch to. this may move the
+  // process's kernel page table to a new ASID, so do it first.
+  uint64 satp = usersatp(p);
+
   // set up trapframe values that uservec will need when
   // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
+  p->trapframe->kernel_satp = r_satp();         // process's kernel page table
   p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
   p->trapframe->kernel_trap = (uint64)usertrap;
   p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
@@ -118,14 +147,11 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
-
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64))fn)(p->trapframeva, satp);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -143,15 +169,39 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  if(faultperm(scause) && sepc >= (uint64)ucopybegin && sepc < (uint64)ucopyend){
+    // a page fault while copying to or from user memory.
+    // unless the copy holds a spinlock, vmfault() may read in a
+    // text page or a page from swap; otherwise (see vmretry())
+    // the page may still be there already,
+    // and the process's kernel page table or this hart's TLB
+    // was behind. either way, catch up and retry.
+    struct proc *p = myproc();
+    uint64 va = r_stval();
+    int ok;
+    if(mycpu()->noff == 0)
+      ok = (vmfault(p, va, faultperm(scause)) == 0);
+    else
+      ok = uvmcheck(p->pagetable, va, faultperm(scause));
+    if(ok){
+      kvmsync(p->kpagetable, p->pagetable);
+      sfence_vma();
+    } else {
+      // a bad user address: make the copy return -1.
+      sepc = (uint64)ucopyfault;
+    }
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
   // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING){
+    myproc()->ru.stime++;
+    myproc()->ru.nivcsw++;
     yield();
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -164,8 +214,13 @@ clockintr()
 {
   acquire(&tickslock);
   ticks++;
-  wakeup(&ticks);
   release(&tickslock);
+  polltick();
+
+  // kalloc() can't wake swapd itself, since its callers
+  // may hold any lock.
+  if(kmemlow())
+    swapkick();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -204,15 +259,21 @@ devintr()
     // software interrupt from a machine-mode timer interrupt,
     // forwarded by timervec in kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
-    // the SSIP bit in sip.
+    // the SSIP bit in sip, before timerintr() looks at
+    // what the interrupt was for.
     w_sip(r_sip() & ~2);
 
-    return 2;
+    // the interrupt may be only for a sleep timer's deadline.
+    // while profiling, only some intervals are ticks; the
+    // others shouldn't make the process yield.
+    int tick = timerintr() && proftick();
+
+    if(tick && cpuid() == 0){
+      clockintr();
+    }
+
+    return tick ? 2 : 1;
   } else {
     return 0;
   }
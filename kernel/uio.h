@@ -0,0 +1,5 @@
+// a buffer for readv() and writev().
+struct iovec {
+  void *base;
+  uint64 len;
+};
@@ -3,6 +3,10 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "rusage.h"
+#include "proc.h"
+#include "kstat.h"
 #include "defs.h"
 #include "fs.h"
 
@@ -15,8 +19,13 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static pte_t *walklevel(pagetable_t, uint64, int, int);
+
 /*
  * create a direct-map page table for the kernel.
+ * devices and RAM are the same in every process's kernel
+ * page table and are never in user page tables, so they
+ * are global: their TLB entries serve every ASID.
  */
 void
 kvminit()
@@ -25,19 +34,20 @@ kvminit()
   memset(kernel_pagetable, 0, PGSIZE);
 
   // uart registers
-  kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(UART0, UART0, PGSIZE, PTE_R | PTE_W | PTE_G);
 
   // virtio mmio disk interface
-  kvmmap(VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W | PTE_G);
 
   // PLIC
-  kvmmap(PLIC, PLIC, 0x400000, PTE_R | PTE_W);
+  kvmmap(PLIC, PLIC, 0x400000, PTE_R | PTE_W | PTE_G);
 
   // map kernel text executable and read-only.
-  kvmmap(KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
+  kvmmap(KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X | PTE_G);
 
   // map kernel data and the physical RAM we'll make use of.
-  kvmmap((uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W);
+  // mappages() uses megapages for the aligned part of this.
+  kvmmap((uint64)etext, (uint64)etext, PHYSTOP-(uint64)etext, PTE_R | PTE_W | PTE_G);
 
   // map the trampoline for trap entry/exit to
   // the highest virtual address in the kernel.
@@ -49,13 +59,70 @@ kvminit()
 void
 kvminithart()
 {
-  w_satp(MAKE_SATP(kernel_pagetable));
+  w_satp(MAKE_SATP(kernel_pagetable, 0));
   sfence_vma();
 }
 
-// Return the address of the PTE in page table pagetable
-// that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// Create a kernel page table for a process. It shares the
+// kernel's mappings, except that addresses below PLIC, which the
+// kernel does not use, map the process's user memory, so that
+// copyin() and copyout() can reach it directly. kvmsync() keeps
+// that part in step with the user page table.
+// Returns 0 if out of memory.
+pagetable_t
+kvmcreate(void)
+{
+  pagetable_t kpagetable, table, ktable;
+
+  if((kpagetable = (pagetable_t) kalloc()) == 0)
+    return 0;
+  if((table = (pagetable_t) kalloc()) == 0){
+    kfree(kpagetable);
+    return 0;
+  }
+  // user memory and PLIC share the first gigabyte, so that
+  // level-1 page table is the process's own, with the kernel's
+  // entries from PLIC up. the level-2 entries above it point to
+  // the kernel's own page-table pages, which never change once
+  // procinit() has mapped the kernel stacks.
+  memmove(kpagetable, kernel_pagetable, PGSIZE);
+  ktable = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  memset(table, 0, PGSIZE);
+  for(int i = PX(1, PLIC); i < 512; i++)
+    table[i] = ktable[i];
+  kpagetable[0] = PA2PTE(table) | PTE_V;
+  return kpagetable;
+}
+
+// Make the user part of kpagetable match pagetable, after
+// level-1 entries of pagetable may have changed: a new level-0
+// page table or megapage mapped, or a megapage split or unmapped.
+// Pages mapped under existing level-0 page tables need no sync,
+// since kpagetable shares those page-table pages.
+void
+kvmsync(pagetable_t kpagetable, pagetable_t pagetable)
+{
+  pagetable_t table = (pagetable_t)PTE2PA(kpagetable[0]);
+  pagetable_t utable = 0;
+
+  if(pagetable[0] & PTE_V)
+    utable = (pagetable_t)PTE2PA(pagetable[0]);
+  for(int i = 0; i < PX(1, PLIC); i++)
+    table[i] = utable ? utable[i] : 0;
+}
+
+// Free a process's kernel page table, but not the user
+// page-table pages it shares.
+void
+kvmfree(pagetable_t kpagetable)
+{
+  kfree((void*)PTE2PA(kpagetable[0]));
+  kfree((void*)kpagetable);
+}
+
+// Return the address of the PTE in the level-0 or level-1 page
+// table of pagetable that corresponds to virtual address va.
+// If alloc!=0, create any required page-table pages above level.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -65,15 +132,22 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A leaf PTE in a level-1 page table maps a 2 MiB megapage;
+// if va falls in one, walklevel() returns that PTE instead.
+// Runs of pages are better walked with a cursor; see
+// cursorinit().
 static pte_t *
-walk(pagetable_t pagetable, uint64 va, int alloc)
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int level)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
+  for(int l = 2; l > level; l--) {
+    pte_t *pte = &pagetable[PX(l, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
@@ -82,9 +156,126 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
+  return &pagetable[PX(level, va)];
+}
+
+// Return the leaf PTE that maps va, and set *sz to the size of
+// the page it maps (PGSIZE or MEGAPGSIZE).
+// Returns 0 if there is no page-table page for va.
+static pte_t *
+walkleaf(pagetable_t pagetable, uint64 va, uint64 *sz)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    panic("walkleaf");
+
+  for(int level = 2; level > 0; level--) {
+    pte = &pagetable[PX(level, va)];
+    if((*pte & PTE_V) == 0)
+      return 0;
+    if(PTE_LEAF(*pte)) {
+      *sz = 1L << PXSHIFT(level);
+      return pte;
+    }
+    pagetable = (pagetable_t)PTE2PA(*pte);
+  }
+  *sz = PGSIZE;
   return &pagetable[PX(0, va)];
 }
 
+// Split the megapage mapped by level-1 leaf *pte into 512
+// level-0 PTEs with the same permissions, in the zeroed or
+// otherwise expendable page table.
+static void
+demote(pte_t *pte, pagetable_t table)
+{
+  uint64 pa = PTE2PA(*pte);
+  uint64 flags = PTE_FLAGS(*pte);
+
+  for(int i = 0; i < 512; i++)
+    table[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(table) | PTE_V;
+}
+
+// Start a walk over runs of pages in pagetable. The cursor
+// remembers the level-0 page table it last reached, so
+// consecutive pages cost one walk from the root per 512 pages
+// (2 MiB) instead of one per page.
+void
+cursorinit(struct ptcursor *c, pagetable_t pagetable)
+{
+  c->pagetable = pagetable;
+  c->base = 0;
+  c->table = 0;
+}
+
+// Like walkleaf(), but through cursor c. If alloc!=0, create
+// any required page-table pages. Sets *sz to MEGAPGSIZE if va
+// falls in a megapage, else PGSIZE.
+pte_t *
+cursorwalk(struct ptcursor *c, uint64 va, int alloc, uint64 *sz)
+{
+  pte_t *pte;
+  pagetable_t table;
+
+  if(c->table == 0 || va - c->base >= MEGAPGSIZE){
+    c->table = 0;
+    if((pte = walklevel(c->pagetable, va, alloc, 1)) == 0)
+      return 0;
+    if(PTE_LEAF(*pte)){
+      *sz = MEGAPGSIZE;
+      return pte;
+    }
+    if((*pte & PTE_V) == 0){
+      if(!alloc || (table = (pagetable_t)kalloc()) == 0)
+        return 0;
+      memset(table, 0, PGSIZE);
+      *pte = PA2PTE(table) | PTE_V;
+    }
+    c->table = (pagetable_t)PTE2PA(*pte);
+    c->base = va & ~(MEGAPGSIZE - 1);
+  }
+  *sz = PGSIZE;
+  return &c->table[PX(0, va)];
+}
+
+// Like walkaddr(), for a run of pages through cursor c.
+uint64
+cursoraddr(struct ptcursor *c, uint64 va)
+{
+  pte_t *pte;
+  uint64 sz;
+
+  if(va >= MAXVA)
+    return 0;
+
+  pte = cursorwalk(c, va, 0, &sz);
+  if(pte == 0)
+    return 0;
+  if((*pte & PTE_V) == 0)
+    return 0;
+  if((*pte & PTE_U) == 0)
+    return 0;
+  return PTE2PA(*pte) + (PGROUNDDOWN(va) & (sz - 1));
+}
+
+// Map the page at va to pa through cursor c.
+// Returns -1 if a page-table page can't be allocated.
+static int
+cursormap(struct ptcursor *c, uint64 va, uint64 pa, int perm)
+{
+  pte_t *pte;
+  uint64 sz;
+
+  if((pte = cursorwalk(c, va, 1, &sz)) == 0)
+    return -1;
+  if(*pte & PTE_V)
+    panic("remap");
+  *pte = PA2PTE(pa) | perm | PTE_V;
+  return 0;
+}
+
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
@@ -92,22 +283,128 @@ uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
-  uint64 pa;
+  uint64 pa, sz;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walkleaf(pagetable, va, &sz);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  // the 4096-byte page within a megapage.
+  pa = PTE2PA(*pte) + (PGROUNDDOWN(va) & (sz - 1));
   return pa;
 }
 
+// Is user address va mapped with all the permissions in perm?
+// A page fault on such an address came from a stale TLB entry,
+// or from hardware that faults rather than set PTE_A or PTE_D
+// itself; so set those here.
+int
+uvmcheck(pagetable_t pagetable, uint64 va, int perm)
+{
+  pte_t *pte;
+  uint64 sz;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walkleaf(pagetable, va, &sz);
+  if(pte == 0)
+    return 0;
+  perm |= PTE_V | PTE_U;
+  if((*pte & perm) != perm)
+    return 0;
+  *pte |= PTE_A | ((perm & PTE_W) ? PTE_D : 0);
+  return 1;
+}
+
+// Handle a page fault by p at user address va, for an access
+// that needed perm (PTE_R, PTE_W or PTE_X). If the page is in
+// swap, read it back; if it is part of the program text that
+// exec() left unmapped, map it from the text cache. Returns 0 if
+// the access may be retried (after a TLB flush, in case the page
+// was there all along), -1 if it is bad.
+// May sleep reading the disk, so p must hold no spinlocks.
+int
+vmfault(struct proc *p, uint64 va, int perm)
+{
+  struct tgroup *tg = p->tg;
+  struct textseg *t = &tg->text;
+  uint64 a, pa, n;
+  int r;
+
+  kstat(KS_PGFAULT, va);
+  p->ru.faults++;
+  if(uvmcheck(p->pagetable, va, perm))
+    return 0;
+  if(va >= p->sz)
+    return -1;
+  if((r = swapin(p, va, perm)) <= 0)
+    return r;
+  if(t->ip == 0 || va < t->va || va >= t->end || (perm & ~t->perm) != 0)
+    return -1;
+
+  a = PGROUNDDOWN(va);
+  n = 0;
+  if(a < t->fileend)
+    n = t->fileend - a < PGSIZE ? t->fileend - a : PGSIZE;
+  if((pa = pcacheget(t->ip, t->off + (a - t->va), n)) == 0)
+    return -1;
+
+  acquire(&tg->lock);
+  if(walkaddr(p->pagetable, a) != 0){
+    // another thread got here first.
+    kfree((void*)pa);
+  } else if(mappages(p->pagetable, a, PGSIZE, pa, t->perm) != 0){
+    release(&tg->lock);
+    kfree((void*)pa);
+    return -1;
+  }
+  kvmsync(p->kpagetable, p->pagetable);
+  release(&tg->lock);
+  return 0;
+}
+
+// Fault in the pages from user address va to va+len of the
+// current process that a copy with perm would touch, so that
+// the copy can be made later while holding locks that reading
+// them in would need. Returns -1 if any is bad.
+int
+vmtouch(uint64 va, uint64 len, int perm)
+{
+  struct proc *p = myproc();
+  uint64 a;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE)
+    if(!uvmcheck(p->pagetable, a, perm) && vmfault(p, a, perm) < 0)
+      return -1;
+  return 0;
+}
+
+// A copy to or from the current process's user address va,
+// made while holding spinlock lk, failed. A fault there could
+// not sleep to read in the page (text not yet mapped, or a page
+// in swap), so release lk, fault the page in, and reacquire lk.
+// Returns 0 if the copy should be retried, -1 if va is bad.
+int
+vmretry(uint64 va, int perm, struct spinlock *lk)
+{
+  struct proc *p = myproc();
+  int r;
+
+  // if the page is there, the copy failed for good.
+  if(uvmcheck(p->pagetable, va, perm))
+    return -1;
+  release(lk);
+  r = vmfault(p, va, perm);
+  acquire(lk);
+  return r;
+}
+
 // add a mapping to the kernel page table.
 // only used when booting.
 // does not flush TLB or enable paging.
@@ -120,22 +417,40 @@ kvmmap(uint64 va, uint64 pa, uint64 sz, int perm)
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Where both va and pa are megapage-aligned
+// and a whole megapage remains, maps it with one level-1 leaf.
+// Returns 0 on success, -1 if walklevel() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
   uint64 a, last;
   pte_t *pte;
+  struct ptcursor c;
 
+  cursorinit(&c, pagetable);
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    if(a % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 &&
+       last - a >= MEGAPGSIZE - PGSIZE){
+      if((pte = walklevel(pagetable, a, 1, 1)) == 0)
+        return -1;
+      if(PTE_LEAF(*pte))
+        panic("remap");
+      // if a level-0 page table is already in the
+      // way, fall back to mapping pages one by one.
+      if((*pte & PTE_V) == 0){
+        *pte = PA2PTE(pa) | perm | PTE_V;
+        if(a + MEGAPGSIZE - PGSIZE == last)
+          break;
+        a += MEGAPGSIZE;
+        pa += MEGAPGSIZE;
+        continue;
+      }
+    }
+    if(cursormap(&c, a, pa, perm) != 0)
       return -1;
-    if(*pte & PTE_V)
-      panic("remap");
-    *pte = PA2PTE(pa) | perm | PTE_V;
     if(a == last)
       break;
     a += PGSIZE;
@@ -144,31 +459,119 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   return 0;
 }
 
+#define NDEAD 32
+
+// Pages unmapped by uvmunmapsync(), waiting for this hart's
+// TLB to forget them before they are freed.
+struct deadpages {
+  int n;
+  uint64 pa[NDEAD];     // low bit set for a megapage
+};
+
+static void
+freedead(struct deadpages *d)
+{
+  sfence_vma();
+  for(int i = 0; i < d->n; i++){
+    if(d->pa[i] & 1)
+      kfreemega((void*)(d->pa[i] & ~1L));
+    else
+      kfree((void*)d->pa[i]);
+  }
+  d->n = 0;
+}
+
+static int unmap(pagetable_t, uint64, uint64, int, struct deadpages *);
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
-void
+// page-aligned. Pages that are not mapped, like exec's stack
+// guard and text not yet faulted in, are skipped.
+// Optionally free the physical memory, or swap slot.
+// Returns 0, or -1 if there was no memory to split a megapage
+// that is only partly unmapped and not freed; then the mappings
+// from that megapage on are left in place.
+int
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
+  return unmap(pagetable, va, npages, do_free, 0);
+}
+
+// Like uvmunmap(pagetable, va, npages, 1) for an address space
+// that this hart may have cached translations for, and that no
+// other hart is using (see tgstop() in proc.c): flushes this
+// hart's TLB before it frees each batch of pages.
+void
+uvmunmapsync(pagetable_t pagetable, uint64 va, uint64 npages)
+{
+  struct deadpages d;
+
+  d.n = 0;
+  unmap(pagetable, va, npages, 1, &d);
+  freedead(&d);
+}
+
+static int
+unmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free,
+      struct deadpages *dead)
+{
+  uint64 a, sz, end;
   pte_t *pte;
+  pagetable_t table;
+  struct ptcursor c;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+  cursorinit(&c, pagetable);
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a += sz){
+    if((pte = cursorwalk(&c, a, 0, &sz)) == 0){
+      // no page table: nothing mapped up to the next megapage.
+      sz = MEGAPGSIZE - a % MEGAPGSIZE;
+      continue;
+    }
+    if((*pte & PTE_V) == 0){
+      if(*pte & PTE_SWAP){
+        if(do_free)
+          swapput(PTE2SLOT(*pte));
+        *pte = 0;
+      }
+      continue;
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
+    if(sz == MEGAPGSIZE && (a % MEGAPGSIZE != 0 || a + MEGAPGSIZE > end)){
+      // removing only part of a megapage: split it into pages.
+      // when freeing, the page at a is about to go anyway, so
+      // it can serve as the new page-table page. The pieces go
+      // back to kfree() one by one, and never to the megapage
+      // pool as a whole.
+      sz = PGSIZE;
+      if(do_free){
+        table = (pagetable_t)(PTE2PA(*pte) + a % MEGAPGSIZE);
+        demote(pte, table);
+        table[PX(0, a)] = 0;
+        continue;
+      }
+      if((table = (pagetable_t)kalloc()) == 0)
+        return -1;
+      demote(pte, table);
+      pte = &table[PX(0, a)];
+    }
     if(do_free){
       uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+      if(dead){
+        if(dead->n == NDEAD)
+          freedead(dead);
+        dead->pa[dead->n++] = pa | (sz == MEGAPGSIZE);
+      } else if(sz == MEGAPGSIZE)
+        kfreemega((void*)pa);
+      else
+        kfree((void*)pa);
     }
     *pte = 0;
   }
+  return 0;
 }
 
 // create an empty user page table.
@@ -202,24 +605,38 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
 
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
+// Aligned 2 MiB stretches get megapages while the pool lasts.
 uint64
 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 {
   char *mem;
   uint64 a;
+  struct ptcursor c;
 
   if(newsz < oldsz)
     return oldsz;
 
+  cursorinit(&c, pagetable);
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
+    if(a % MEGAPGSIZE == 0 && newsz - a >= MEGAPGSIZE &&
+       (mem = kallocmega()) != 0){
+      memset(mem, 0, MEGAPGSIZE);
+      if(mappages(pagetable, a, MEGAPGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+        kfreemega(mem);
+        uvmdealloc(pagetable, a, oldsz);
+        return 0;
+      }
+      a += MEGAPGSIZE - PGSIZE;
+      continue;
+    }
     mem = kalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
     memset(mem, 0, PGSIZE);
-    if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    if(cursormap(&c, a, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
       return 0;
@@ -246,6 +663,21 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
+// Like uvmdealloc(), with uvmunmapsync() to unmap the pages.
+uint64
+uvmdeallocsync(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
+{
+  if(newsz >= oldsz)
+    return oldsz;
+
+  if(PGROUNDUP(newsz) < PGROUNDUP(oldsz)){
+    int npages = (PGROUNDUP(oldsz) - PGROUNDUP(newsz)) / PGSIZE;
+    uvmunmapsync(pagetable, PGROUNDUP(newsz), npages);
+  }
+
+  return newsz;
+}
+
 // Recursively free page-table pages.
 // All leaf mappings must already have been removed.
 void
@@ -279,28 +711,64 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 // Given a parent process's page table, copy
 // its memory into a child's page table.
 // Copies both the page table and the
-// physical memory.
+// physical memory, except that read-only
+// pages, like program text, and shared
+// memory (see shm.c) are shared, as are
+// the slots of pages in swap.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
-  uint64 pa, i;
+  pte_t *pte, *npte;
+  uint64 pa, i, len;
   uint flags;
   char *mem;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  struct ptcursor from, to;
+
+  cursorinit(&from, old);
+  cursorinit(&to, new);
+  for(i = 0; i < sz; i += len){
+    if((pte = cursorwalk(&from, i, 0, &len)) == 0){
+      len = MEGAPGSIZE - i % MEGAPGSIZE;
+      continue;
+    }
+    if((*pte & PTE_V) == 0){
+      if(*pte & PTE_SWAP){
+        if((npte = cursorwalk(&to, i, 1, &len)) == 0)
+          goto err;
+        swapdup(PTE2SLOT(*pte));
+        *npte = *pte;
+      }
+      continue;
+    }
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
+    if(((flags & PTE_W) == 0 || (flags & PTE_SHARED)) && len == PGSIZE){
+      kdup((void*)pa);
+      if(cursormap(&to, i, pa, flags) != 0){
+        kfree((void*)pa);
+        goto err;
+      }
+      continue;
+    }
+    if(len == MEGAPGSIZE){
+      if(i % MEGAPGSIZE == 0 && (mem = kallocmega()) != 0){
+        memmove(mem, (char*)pa, MEGAPGSIZE);
+        if(mappages(new, i, MEGAPGSIZE, (uint64)mem, flags) != 0){
+          kfreemega(mem);
+          goto err;
+        }
+        continue;
+      }
+      // no megapage free: copy this one a page at a time.
+      pa += i % MEGAPGSIZE;
+      len = PGSIZE;
+    }
     if((mem = kalloc()) == 0)
       goto err;
     memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
+    if(cursormap(&to, i, (uint64)mem, flags) != 0){
       kfree(mem);
       goto err;
     }
@@ -312,17 +780,34 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
-// mark a PTE invalid for user access.
+// unmap and free the page at va, leaving a hole that
+// neither user code nor the kernel's direct copies can touch.
 // used by exec for the user stack guard page.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   
-  pte = walk(pagetable, va, 0);
-  if(pte == 0)
+  uint64 sz;
+
+  pte = walkleaf(pagetable, va, &sz);
+  if(pte == 0 || (*pte & PTE_V) == 0 || sz != PGSIZE)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  kfree((void*)PTE2PA(*pte));
+  *pte = 0;
+}
+
+// Can the kernel reach len bytes of user memory at va in
+// pagetable directly, through the current process's kernel
+// page table? Not if pagetable belongs to some other address
+// space (e.g. exec's new one), or the range is not below PLIC.
+static int
+ucopyok(pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+
+  return p != 0 && pagetable == p->pagetable &&
+    va < PLIC && len <= PLIC - va;
 }
 
 // Copy from kernel to user.
@@ -333,6 +818,9 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(ucopyok(pagetable, dstva, len))
+    return ucopy((void*)dstva, src, len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
     pa0 = walkaddr(pagetable, va0);
@@ -358,6 +846,9 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(ucopyok(pagetable, srcva, len))
+    return ucopy(dst, (void*)srcva, len);
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
@@ -385,6 +876,13 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(ucopyok(pagetable, srcva, 0)){
+    // stop at PLIC; the string must end before it.
+    if(max > PLIC - srcva)
+      max = PLIC - srcva;
+    return ucopystr(dst, (void*)srcva, max);
+  }
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
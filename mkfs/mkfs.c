@@ -172,6 +172,9 @@ main(int argc, char *argv[])
 
   balloc(freeblock);
 
+  // the swap area follows the file system; see kernel/swap.c.
+  wsect(FSSIZE + SWAPSIZE - 1, zeroes);
+
   exit(0);
 }
 
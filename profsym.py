@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+# Symbolize the output of xv6's prof command.
+#
+# usage: profsym.py [console-output]
+#
+# Reads "prof pid name k|u pc [caller...]" lines (other lines are
+# ignored) and prints each distinct stack with its number of
+# samples, folded as flamegraph.pl expects:
+#   name;outermost;...;innermost count
+# Kernel addresses are looked up in kernel/kernel.sym and user
+# addresses in user/name.sym, as the Makefile writes them.
+
+import bisect
+import os
+import sys
+from collections import Counter
+
+here = os.path.dirname(os.path.abspath(__file__))
+tables = {}
+
+def symtable(path):
+    if path not in tables:
+        syms = []
+        try:
+            with open(path) as f:
+                for line in f:
+                    parts = line.split()
+                    if len(parts) == 2:
+                        syms.append((int(parts[0], 16), parts[1]))
+        except OSError:
+            pass
+        syms.sort()
+        tables[path] = ([a for a, _ in syms], [n for _, n in syms])
+    return tables[path]
+
+def symbolize(path, pc):
+    addrs, names = symtable(path)
+    i = bisect.bisect_right(addrs, pc) - 1
+    return names[i] if i >= 0 else hex(pc)
+
+def main():
+    f = open(sys.argv[1]) if len(sys.argv) > 1 else sys.stdin
+    stacks = Counter()
+    for line in f:
+        parts = line.split()
+        if len(parts) < 5 or parts[0] != "prof":
+            continue
+        name, where = parts[2], parts[3]
+        if where == "k":
+            path = os.path.join(here, "kernel", "kernel.sym")
+        else:
+            path = os.path.join(here, "user", name + ".sym")
+        frames = [symbolize(path, int(pc, 16)) for pc in parts[4:]]
+        stacks[";".join([name] + frames[::-1])] += 1
+    for stack, n in stacks.most_common():
+        print(stack, n)
+
+if __name__ == "__main__":
+    main()
@@ -19,6 +19,9 @@ main(void)
   if(open("console", O_RDWR) < 0){
     mknod("console", CONSOLE, 0);
     mknod("statistics", STATS, 0);
+    mknod("trace", TRACE, 0);
+    mknod("prof", PROF, 0);
+    mknod("systrace", SYSTRACE, 0);
     open("console", O_RDWR);
   }
   dup(0);  // stdout
@@ -0,0 +1,94 @@
+// prof: run a command, sampling where every CPU is while it runs.
+//
+// usage: prof [-r rate] command [arg...]
+//
+// Prints a line per sample:
+//   prof pid name k|u pc [caller...]
+// with the addresses in hex. To symbolize them, capture the
+// console output and run profsym.py on it, on the host; it looks
+// the addresses up in kernel/kernel.sym and user/name.sym, and
+// writes stacks folded for flame graphs.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/poll.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+struct profsample s[16];
+
+// Print the samples waiting in the kernel.
+void
+drain(int fd)
+{
+  int n;
+
+  while((n = read(fd, s, sizeof(s))) > 0){
+    for(int i = 0; i < n / sizeof(s[0]); i++){
+      printf("prof %d %s %c", s[i].pid, s[i].pid ? s[i].name : "-",
+             s[i].user ? 'u' : 'k');
+      for(int j = 0; j < PROFDEPTH && s[i].pc[j]; j++)
+        printf(" %p", s[i].pc[j]);
+      printf("\n");
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char cmd[16] = "start 10";
+  struct pollfd pfd;
+  int fd, p[2], pid, xstatus;
+
+  if(argc > 2 && strcmp(argv[1], "-r") == 0){
+    if(strlen(argv[2]) >= sizeof(cmd) - 6){
+      fprintf(2, "prof: bad rate %s\n", argv[2]);
+      exit(1);
+    }
+    strcpy(cmd + 6, argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+  if(argc < 2){
+    fprintf(2, "usage: prof [-r rate] command [arg...]\n");
+    exit(1);
+  }
+  if((fd = open("prof", O_RDWR)) < 0){
+    fprintf(2, "prof: cannot open prof\n");
+    exit(1);
+  }
+  if(pipe(p) < 0){
+    fprintf(2, "prof: pipe failed\n");
+    exit(1);
+  }
+  if(write(fd, cmd, strlen(cmd)) < 0){
+    fprintf(2, "prof: bad rate\n");
+    exit(1);
+  }
+
+  if((pid = fork()) < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    // the pipe's write end closes when the command exits.
+    close(fd);
+    close(p[0]);
+    exec(argv[1], argv + 1);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  close(p[1]);
+
+  pfd.fd = p[0];
+  pfd.events = POLLIN;
+  do {
+    drain(fd);
+  } while(poll(&pfd, 1, 1) == 0);
+
+  write(fd, "stop", 4);
+  drain(fd);
+  wait(&xstatus);
+  exit(xstatus);
+}
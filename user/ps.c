@@ -0,0 +1,55 @@
+// ps: list processes and the resources they have used.
+//
+// usage: ps [-c]
+//
+// -c adds in what each process's waited-for children used.
+// Times are in clock ticks.
+
+#include "kernel/types.h"
+#include "kernel/rusage.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+struct procinfo pi[NPROC];
+
+char *states[] = { "unused", "sleep", "runble", "run", "zombie" };
+
+int
+main(int argc, char *argv[])
+{
+  int n, children = 0;
+
+  if(argc > 1 && strcmp(argv[1], "-c") == 0)
+    children = 1;
+  else if(argc > 1){
+    fprintf(2, "usage: ps [-c]\n");
+    exit(1);
+  }
+  if((n = procinfo(pi, NPROC)) < 0){
+    fprintf(2, "ps: procinfo failed\n");
+    exit(1);
+  }
+
+  printf("pid ppid state sz utime stime vcsw ivcsw faults rbytes wbytes rblocks wblocks name\n");
+  for(int i = 0; i < n; i++){
+    struct procinfo *p = &pi[i];
+    struct rusage ru = p->ru;
+    if(children){
+      ru.utime += p->cru.utime;
+      ru.stime += p->cru.stime;
+      ru.nvcsw += p->cru.nvcsw;
+      ru.nivcsw += p->cru.nivcsw;
+      ru.faults += p->cru.faults;
+      ru.rbytes += p->cru.rbytes;
+      ru.wbytes += p->cru.wbytes;
+      ru.rblocks += p->cru.rblocks;
+      ru.wblocks += p->cru.wblocks;
+    }
+    printf("%d %d %s %l %l %l %l %l %l %l %l %l %l %s%s\n", p->pid, p->ppid,
+           p->state >= 0 && p->state < sizeof(states)/sizeof(states[0]) ? states[p->state] : "?",
+           p->sz, ru.utime, ru.stime, ru.nvcsw, ru.nivcsw, ru.faults,
+           ru.rbytes, ru.wbytes, ru.rblocks, ru.wblocks, p->name,
+           p->thread ? " (thread)" : "");
+  }
+  exit(0);
+}
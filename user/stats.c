@@ -1,16 +1,150 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/kstat.h"
 #include "user/user.h"
 
+// usage: stats                 print everything
+//        stats prefix...       print the counters named prefix...
+//        stats -r [prefix]     reset counters
+//        stats -t [prefix]     trace their events
+//        stats -u [prefix]     stop tracing them
+//        stats -d              print and empty the trace
+
 #define SZ 4096
 char buf[SZ];
+char report[4*SZ];
+char *names[NKSTAT];
+
+// Read the whole statistics report into report[].
+int
+readreport(void)
+{
+  int n = statistics(report, sizeof(report) - 1);
+
+  report[n] = 0;
+  return n;
+}
+
+int
+hasprefix(char *s, char *prefix)
+{
+  return strlen(prefix) <= strlen(s) && memcmp(s, prefix, strlen(prefix)) == 0;
+}
+
+// Print the counter lines ("id name count") whose name
+// starts with one of the n prefixes.
+void
+printcounters(char **prefix, int n)
+{
+  char *line, *next, *name;
+  int counters = 0;
+
+  readreport();
+  for(line = report; *line; line = next){
+    if((next = strchr(line, '\n')) != 0)
+      *next++ = 0;
+    else
+      next = line + strlen(line);
+    if(strcmp(line, "--- counters") == 0){
+      counters = 1;
+      continue;
+    }
+    if(!counters || (name = strchr(line, ' ')) == 0)
+      continue;
+    name++;
+    for(int i = 0; i < n; i++){
+      if(hasprefix(name, prefix[i])){
+        printf("%s\n", name);
+        break;
+      }
+    }
+  }
+}
+
+// Send cmd with prefix to the kernel counters.
+void
+control(char *cmd, char *prefix)
+{
+  int fd;
+
+  strcpy(buf, cmd);
+  strcpy(buf + strlen(buf), " ");
+  strcpy(buf + strlen(buf), prefix);
+  if((fd = open("statistics", O_WRONLY)) < 0 || write(fd, buf, strlen(buf)) < 0){
+    fprintf(2, "stats: %s failed\n", cmd);
+    exit(1);
+  }
+  close(fd);
+}
+
+// Print the traced events, naming them from the counter list.
+void
+dumptrace(void)
+{
+  struct kevent ev[SZ / sizeof(struct kevent)];
+  char *line, *next, *name;
+  int fd, n, id, counters = 0;
+
+  readreport();
+  for(line = report; *line; line = next){
+    if((next = strchr(line, '\n')) != 0)
+      *next++ = 0;
+    else
+      next = line + strlen(line);
+    if(strcmp(line, "--- counters") == 0){
+      counters = 1;
+      continue;
+    }
+    if(!counters || (name = strchr(line, ' ')) == 0)
+      continue;
+    *name++ = 0;
+    if((id = atoi(line)) >= 0 && id < NKSTAT && (line = strchr(name, ' ')) != 0){
+      *line = 0;
+      names[id] = name;
+    }
+  }
+
+  if((fd = open("trace", O_RDONLY)) < 0){
+    fprintf(2, "stats: open trace failed\n");
+    exit(1);
+  }
+  while((n = read(fd, ev, sizeof(ev))) > 0){
+    for(int i = 0; i < n / sizeof(ev[0]); i++){
+      struct kevent *e = &ev[i];
+      printf("%l cpu %d pid %d %s %p\n", e->time, e->cpu, e->pid,
+             e->id < NKSTAT && names[e->id] ? names[e->id] : "?", e->arg);
+    }
+  }
+  close(fd);
+}
 
 int
-main(void)
+main(int argc, char *argv[])
 {
   int i, n;
-  
+
+  if(argc > 1 && argv[1][0] == '-'){
+    char *prefix = argc > 2 ? argv[2] : "";
+    if(strcmp(argv[1], "-r") == 0)
+      control("reset", prefix);
+    else if(strcmp(argv[1], "-t") == 0)
+      control("trace", prefix);
+    else if(strcmp(argv[1], "-u") == 0)
+      control("untrace", prefix);
+    else if(strcmp(argv[1], "-d") == 0)
+      dumptrace();
+    else {
+      fprintf(2, "usage: stats [-r|-t|-u prefix | -d | prefix...]\n");
+      exit(1);
+    }
+    exit(0);
+  }
+  if(argc > 1){
+    printcounters(argv + 1, argc - 1);
+    exit(0);
+  }
+
   while (1) {
     n = statistics(buf, SZ);
     for (i = 0; i < n; i++) {
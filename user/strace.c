@@ -0,0 +1,87 @@
+// strace: run a command, printing each system call it and its
+// children make.
+//
+// usage: strace [-m mask] command [arg...]
+//
+// mask has a bit set for each system call number to trace
+// (see kernel/syscall.h); the default traces them all. Prints
+//   pid name(a0, a1, a2) = ret [ticks]
+// for each call, ticks being how long it took in ticks of the
+// time register.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/poll.h"
+#include "kernel/systrace.h"
+#include "user/user.h"
+
+struct sysevent ev[16];
+
+// Print the calls waiting in the kernel.
+void
+drain(int fd)
+{
+  int n;
+
+  while((n = read(fd, ev, sizeof(ev))) > 0){
+    for(int i = 0; i < n / sizeof(ev[0]); i++){
+      struct sysevent *e = &ev[i];
+      printf("%d %s(%p, %p, %p) = %d [%l]\n", e->pid, e->name,
+             e->args[0], e->args[1], e->args[2], (int)e->ret, e->ticks);
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 mask = ~0L;
+  struct pollfd pfd;
+  int fd, p[2], pid, xstatus;
+
+  if(argc > 2 && strcmp(argv[1], "-m") == 0){
+    mask = 0;
+    for(char *c = argv[2]; *c >= '0' && *c <= '9'; c++)
+      mask = mask*10 + *c - '0';
+    argv += 2;
+    argc -= 2;
+  }
+  if(argc < 2){
+    fprintf(2, "usage: strace [-m mask] command [arg...]\n");
+    exit(1);
+  }
+  if((fd = open("systrace", O_RDONLY)) < 0){
+    fprintf(2, "strace: cannot open systrace\n");
+    exit(1);
+  }
+  if(pipe(p) < 0){
+    fprintf(2, "strace: pipe failed\n");
+    exit(1);
+  }
+  drain(fd);   // someone else's leftovers
+
+  if((pid = fork()) < 0){
+    fprintf(2, "strace: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    // the pipe's write end closes when the command exits.
+    close(fd);
+    close(p[0]);
+    systrace(mask);
+    exec(argv[1], argv + 1);
+    fprintf(2, "strace: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  close(p[1]);
+
+  pfd.fd = p[0];
+  pfd.events = POLLIN;
+  do {
+    drain(fd);
+  } while(poll(&pfd, 1, 1) == 0);
+
+  drain(fd);
+  wait(&xstatus);
+  exit(xstatus);
+}
@@ -0,0 +1,78 @@
+//
+// Kernel-scheduled user threads, built on clone() and join().
+// Threads share the address space and open files, and can run
+// in parallel on all CPUs.  malloc() is not thread-safe, so
+// create and join threads from one thread only.
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define TSTACKSIZE 8192
+
+// placed at the bottom of each thread's stack.
+struct tstart {
+  void (*fn)(void*);
+  void *arg;
+};
+
+static struct {
+  int tid;
+  char *stack;
+} threads[NPROC];
+
+static void
+thread_start(void *a)
+{
+  struct tstart *ts = a;
+
+  ts->fn(ts->arg);
+  exit(0);
+}
+
+// Start fn(arg) in a new thread. Returns its thread id, or -1.
+int
+thread_spawn(void (*fn)(void*), void *arg)
+{
+  struct tstart *ts;
+  char *stack;
+  int i, tid;
+
+  for(i = 0; i < NPROC; i++)
+    if(threads[i].stack == 0)
+      break;
+  if(i == NPROC)
+    return -1;
+  if((stack = malloc(TSTACKSIZE)) == 0)
+    return -1;
+  ts = (struct tstart*)stack;
+  ts->fn = fn;
+  ts->arg = arg;
+  if((tid = clone(thread_start, ts, stack + TSTACKSIZE)) < 0){
+    free(stack);
+    return -1;
+  }
+  threads[i].tid = tid;
+  threads[i].stack = stack;
+  return tid;
+}
+
+// Wait for thread tid (or any thread, if tid is 0) to exit,
+// and free its stack. Returns the thread id, or -1.
+int
+thread_join(int tid, int *status)
+{
+  int i;
+
+  if((tid = join(tid, status)) < 0)
+    return -1;
+  for(i = 0; i < NPROC; i++){
+    if(threads[i].stack && threads[i].tid == tid){
+      free(threads[i].stack);
+      threads[i].stack = 0;
+      break;
+    }
+  }
+  return tid;
+}
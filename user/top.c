@@ -0,0 +1,82 @@
+// top: every few ticks, list the processes that used the most
+// CPU time since the last listing.
+//
+// usage: top [-d ticks] [-n count]
+//
+// Lists every ticks ticks (default 10), count times (default
+// 10, 0 for ever).
+
+#include "kernel/types.h"
+#include "kernel/rusage.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define NSHOW 10
+
+struct procinfo pi[2][NPROC];
+int npi[2];
+
+// Ticks of CPU time p used since the listing in old.
+uint64
+used(struct procinfo *p, struct procinfo *old, int nold)
+{
+  uint64 t = p->ru.utime + p->ru.stime;
+
+  for(int i = 0; i < nold; i++)
+    if(old[i].pid == p->pid)
+      return t - (old[i].ru.utime + old[i].ru.stime);
+  return t;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int delay = 10, count = 10, cur = 0;
+  int order[NPROC];
+  uint64 t[NPROC];
+
+  for(int i = 1; i + 1 < argc; i += 2){
+    if(strcmp(argv[i], "-d") == 0)
+      delay = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-n") == 0)
+      count = atoi(argv[i+1]);
+    else
+      argc = -1;
+  }
+  if(argc < 0 || argc % 2 == 0 || delay <= 0){
+    fprintf(2, "usage: top [-d ticks] [-n count]\n");
+    exit(1);
+  }
+
+  npi[cur] = procinfo(pi[cur], NPROC);
+  for(int iter = 0; count == 0 || iter < count; iter++){
+    int old = cur, n;
+    uint64 tot = 0;
+
+    sleep(delay);
+    cur = !cur;
+    if((n = npi[cur] = procinfo(pi[cur], NPROC)) < 0){
+      fprintf(2, "top: procinfo failed\n");
+      exit(1);
+    }
+
+    // sort by time used, most first.
+    for(int i = 0; i < n; i++){
+      t[i] = used(&pi[cur][i], pi[old], npi[old]);
+      tot += t[i];
+      int j;
+      for(j = i; j > 0 && t[order[j-1]] < t[i]; j--)
+        order[j] = order[j-1];
+      order[j] = i;
+    }
+
+    printf("\n%d processes, %l of %d ticks\n", n, tot, delay);
+    printf("pid ticks sz faults vcsw ivcsw name\n");
+    for(int i = 0; i < n && i < NSHOW; i++){
+      struct procinfo *p = &pi[cur][order[i]];
+      printf("%d %l %l %l %l %l %s\n", p->pid, t[order[i]], p->sz,
+             p->ru.faults, p->ru.nvcsw, p->ru.nivcsw, p->name);
+    }
+  }
+  exit(0);
+}
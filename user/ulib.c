@@ -1,6 +1,8 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/syscall.h"
+#include "kernel/batch.h"
 #include "user/user.h"
 
 char*
@@ -73,15 +75,22 @@ gets(char *buf, int max)
 int
 stat(const char *n, struct stat *st)
 {
-  int fd;
-  int r;
-
-  fd = open(n, O_RDONLY);
-  if(fd < 0)
+  // open, fstat and close in one trap into the kernel.
+  struct sysrec r[3] = {
+    { SYS_open,  -1, { (uint64)n, O_RDONLY } },
+    { SYS_fstat,  0, { 0, (uint64)st } },
+    { SYS_close,  0 },
+  };
+
+  switch(syscall_batch(r, 3)){
+  case 3:
+    return (int)r[1].ret;
+  case 2:
+    // fstat failed, so the batch stopped short of close.
+    close((int)r[0].ret);
     return -1;
-  r = fstat(fd, st);
-  close(fd);
-  return r;
+  }
+  return -1;
 }
 
 int
@@ -134,3 +143,103 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// Sleeping locks for threads (see thread.c), built on futexes.
+// m->locked is 0 when free, 1 when held, and 2 when held with
+// threads possibly waiting; only the last case needs the kernel.
+
+void
+mutex_init(struct mutex *m)
+{
+  m->locked = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->locked, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&m->locked, 2);
+  while(c != 0){
+    futex_wait(&m->locked, 2);
+    c = __sync_lock_test_and_set(&m->locked, 2);
+  }
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__sync_fetch_and_sub(&m->locked, 1) != 1){
+    __sync_lock_release(&m->locked);
+    futex_wake(&m->locked, 1);
+  }
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+  c->nwait = 0;
+}
+
+// Atomically release m and wait for a signal; reacquire m.
+// Like pthread_cond_wait(), may return spuriously.
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  __sync_fetch_and_add(&c->nwait, 1);
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  __sync_fetch_and_sub(&c->nwait, 1);
+  mutex_lock(m);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  if(c->nwait > 0)
+    futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  if(c->nwait > 0)
+    futex_wake(&c->seq, c->nwait);
+}
+
+void
+barrier_init(struct barrier *b, int n)
+{
+  mutex_init(&b->lock);
+  cond_init(&b->cond);
+  b->n = n;
+  b->count = 0;
+  b->round = 0;
+}
+
+// Wait until n threads have called barrier_wait().
+void
+barrier_wait(struct barrier *b)
+{
+  int round;
+
+  mutex_lock(&b->lock);
+  round = b->round;
+  if(++b->count == b->n){
+    b->count = 0;
+    b->round++;
+    cond_broadcast(&b->cond);
+  } else {
+    while(round == b->round)
+      cond_wait(&b->cond, &b->lock);
+  }
+  mutex_unlock(&b->lock);
+}
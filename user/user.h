@@ -1,6 +1,30 @@
 struct stat;
 struct rtcdate;
 struct sysinfo;
+struct pollfd;
+struct iovec;
+struct ioring;
+struct sysrec;
+struct rusage;
+struct procinfo;
+
+// ulib.c thread synchronization
+struct mutex {
+  int locked;
+};
+
+struct cond {
+  int seq;     // bumped by every signal
+  int nwait;   // threads in cond_wait()
+};
+
+struct barrier {
+  struct mutex lock;
+  struct cond cond;
+  int n;       // threads to wait for
+  int count;   // threads arrived this round
+  int round;
+};
 
 // system calls
 int fork(void);
@@ -24,6 +48,28 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int clone(void(*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+void* shmat(int, int);
+int shmdt(void*);
+int splice(int, int, int);
+int pipesize(int, int);
+int poll(struct pollfd*, int, int);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+struct ioring* ioring_setup(void);
+int ioring_enter(int);
+int syscall_batch(struct sysrec*, int);
+uint64 systrace(uint64);
+int syslat(int, int, uint*);
+int wait2(int*, struct rusage*);
+int procinfo(struct procinfo*, int);
+int nanosleep(uint64);
+uint64 nanotime(void);
 #ifdef LAB_NET
 int connect(uint32, uint16, uint16);
 #endif
@@ -44,4 +90,15 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+void mutex_init(struct mutex*);
+void mutex_lock(struct mutex*);
+void mutex_unlock(struct mutex*);
+void cond_init(struct cond*);
+void cond_wait(struct cond*, struct mutex*);
+void cond_signal(struct cond*);
+void cond_broadcast(struct cond*);
+void barrier_init(struct barrier*, int);
+void barrier_wait(struct barrier*);
 int statistics(void*, int);
+int thread_spawn(void(*)(void*), void*);
+int thread_join(int, int*);
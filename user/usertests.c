@@ -7,6 +7,15 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/poll.h"
+#include "kernel/uio.h"
+#include "kernel/ioring.h"
+#include "kernel/kstat.h"
+#include "kernel/prof.h"
+#include "kernel/batch.h"
+#include "kernel/systrace.h"
+#include "kernel/rusage.h"
+#include "kernel/elf.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -2050,6 +2059,182 @@ forktest(char *s)
   }
 }
 
+// threads created with clone() share memory and open files,
+// and join() collects them but wait() doesn't.
+int clonecount;
+int clonefd;
+int cloneflag;
+
+void
+clonechild(void *arg)
+{
+  for(int i = 0; i < 1000; i++)
+    __sync_fetch_and_add(&clonecount, 1);
+  if((uint64)arg == 0){
+    clonefd = open("clonefile", O_CREATE|O_RDWR);
+    // wait for the main thread to see the new fd.
+    while(cloneflag == 0)
+      futex_wait(&cloneflag, 0);
+  }
+  exit((int)(uint64)arg);
+}
+
+void
+clonetest(char *s)
+{
+  enum { N = 4 };
+  int tids[N], xstatus;
+
+  clonefd = -1;
+  for(int i = 0; i < N; i++){
+    if((tids[i] = thread_spawn(clonechild, (void*)(uint64)i)) < 0){
+      printf("%s: thread_spawn failed\n", s);
+      exit(1);
+    }
+  }
+  if(wait(0) != -1){
+    printf("%s: wait() reaped a thread\n", s);
+    exit(1);
+  }
+  while(clonefd < 0)
+    sleep(1);
+  if(write(clonefd, "x", 1) != 1){
+    printf("%s: fd opened by thread not shared\n", s);
+    exit(1);
+  }
+  cloneflag = 1;
+  futex_wake(&cloneflag, 1);
+  for(int i = N-1; i >= 0; i--){
+    if(thread_join(tids[i], &xstatus) != tids[i] || xstatus != i){
+      printf("%s: join failed\n", s);
+      exit(1);
+    }
+  }
+  if(thread_join(0, 0) != -1){
+    printf("%s: join got too many\n", s);
+    exit(1);
+  }
+  if(clonecount != N*1000){
+    printf("%s: shared count %d, not %d\n", s, clonecount, N*1000);
+    exit(1);
+  }
+  close(clonefd);
+  unlink("clonefile");
+}
+
+// a thread that writes to fd every tick, for ever.
+void
+tickerchild(void *arg)
+{
+  int fd = (int)(uint64)arg;
+
+  for(;;){
+    if(write(fd, "x", 1) != 1)
+      exit(1);
+    sleep(1);
+  }
+}
+
+// killing a process, or its exiting, stops its threads: once
+// they are gone, nothing holds the pipe's write end open.
+void
+threadkill(char *s)
+{
+  int fds[2], pid, t0;
+  char buf[64];
+
+  for(int how = 0; how < 2; how++){
+    if(pipe(fds) < 0){
+      printf("%s: pipe failed\n", s);
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      // the thread shares fds[1], so it stays open here.
+      if(thread_spawn(tickerchild, (void*)(uint64)fds[1]) < 0)
+        exit(1);
+      sleep(3);
+      if(how == 0)
+        exit(0);
+      for(;;)
+        sleep(100);
+    }
+    close(fds[1]);
+    if(how == 1){
+      sleep(3);
+      kill(pid);
+    }
+    wait(0);
+    t0 = uptime();
+    while(read(fds[0], buf, sizeof(buf)) > 0){
+      if(uptime() - t0 > 20){
+        printf("%s: thread still running after its process %s\n",
+               s, how == 0 ? "exited" : "was killed");
+        exit(1);
+      }
+    }
+    close(fds[0]);
+  }
+}
+
+// mutex and barrier from ulib.c keep threads in step.
+struct mutex lockm;
+struct barrier lockb;
+int lockcount;
+int lockrounds[4];
+
+void
+lockchild(void *arg)
+{
+  int id = (int)(uint64)arg;
+
+  for(int r = 0; r < 20; r++){
+    for(int i = 0; i < 100; i++){
+      mutex_lock(&lockm);
+      lockcount++;
+      mutex_unlock(&lockm);
+    }
+    lockrounds[id] = r;
+    barrier_wait(&lockb);
+    // everyone has finished round r.
+    for(int j = 0; j < 4; j++)
+      if(lockrounds[j] != r)
+        exit(1);
+    barrier_wait(&lockb);
+  }
+  exit(0);
+}
+
+void
+futexlock(char *s)
+{
+  int tids[4], xstatus;
+
+  mutex_init(&lockm);
+  barrier_init(&lockb, 4);
+  for(int i = 0; i < 4; i++){
+    if((tids[i] = thread_spawn(lockchild, (void*)(uint64)i)) < 0){
+      printf("%s: thread_spawn failed\n", s);
+      exit(1);
+    }
+  }
+  for(int i = 0; i < 4; i++){
+    if(thread_join(tids[i], &xstatus) != tids[i] || xstatus != 0){
+      printf("%s: barrier round mismatch\n", s);
+      exit(1);
+    }
+  }
+  if(lockcount != 4*20*100){
+    printf("%s: count %d, not %d\n", s, lockcount, 4*20*100);
+    exit(1);
+  }
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2174,6 +2359,76 @@ sbrkmuch(char *s)
   }
 }
 
+// check that pages below va hold their own addresses, and that
+// [va, top) reads as zero.
+static void
+megacheck(char *s, char *who, uint64 lo, uint64 va, uint64 top)
+{
+  for(uint64 a = lo; a < top; a += PGSIZE){
+    uint64 want = a < va ? a : 0;
+    if(*(uint64*)a != want || *(uint64*)(a + PGSIZE - 8) != want){
+      printf("%s: %s: page %p holds %p, not %p\n",
+             s, who, a, *(uint64*)a, want);
+      exit(1);
+    }
+  }
+}
+
+// grow the heap over aligned 2 MiB stretches, which get
+// megapages, then shrink it to partway through the first one,
+// which must split it, and fork.
+void
+megashrink(char *s)
+{
+  uint64 brk = (uint64)sbrk(0), lo = PGROUNDUP(brk);
+  uint64 mega = (lo + MEGAPGSIZE - 1) & ~(MEGAPGSIZE - 1);
+  uint64 top = mega + 2*MEGAPGSIZE, mid = mega + MEGAPGSIZE/2 + 5*PGSIZE;
+  int pid, xstatus;
+
+  if(sbrk(top - brk) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(uint64 a = lo; a < top; a += PGSIZE){
+    *(uint64*)a = a;
+    *(uint64*)(a + PGSIZE - 8) = a;
+  }
+  if(sbrk(-(top - mid)) == (char*)-1){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  megacheck(s, "parent", lo, mid, mid);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    megacheck(s, "child", lo, mid, mid);
+    // the child's stores must not show in the parent.
+    for(uint64 a = lo; a < mid; a += PGSIZE){
+      *(uint64*)a = 0;
+      *(uint64*)(a + PGSIZE - 8) = 0;
+    }
+    if(sbrk(top - mid) == (char*)-1)
+      exit(1);
+    megacheck(s, "child", lo, lo, top);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  // what was unmapped comes back zeroed.
+  if(sbrk(top - mid) == (char*)-1){
+    printf("%s: sbrk regrow failed\n", s);
+    exit(1);
+  }
+  megacheck(s, "parent", lo, mid, top);
+  sbrk(-(top - brk));
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2198,6 +2453,1084 @@ kernmem(char *s)
   }
 }
 
+// program text is read-only: storing to it should kill the
+// process, and read() into it should fail.
+void
+textwrite(char *s)
+{
+  int pid, xstatus, fd;
+
+  fd = open("textwrite", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  write(fd, "x", 1);
+  close(fd);
+  fd = open("textwrite", O_RDONLY);
+  if(read(fd, (char*)textwrite, 1) != -1){
+    printf("%s: read() into text succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("textwrite");
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    volatile int *addr = (int *) textwrite;
+    *addr = 10;
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: could write to text\n", s);
+    exit(1);
+  }
+}
+
+// write() the program's own text back over itself in its file:
+// the text's pages must be read in from the file that write()
+// holds locked, without deadlocking.
+void
+textself(char *s)
+{
+  static char buf[PGSIZE];
+  struct elfhdr elf;
+  struct proghdr ph;
+  int fd, i, n;
+
+  if((fd = open("usertests", O_RDWR)) < 0)
+    return;   // not run from /
+  if(read(fd, &elf, sizeof(elf)) != sizeof(elf) || elf.magic != ELF_MAGIC){
+    printf("%s: bad elf header\n", s);
+    exit(1);
+  }
+  for(i = 0; i < elf.phnum; i++){
+    if(pread(fd, &ph, sizeof(ph), elf.phoff + i*sizeof(ph)) != sizeof(ph)){
+      printf("%s: read program header failed\n", s);
+      exit(1);
+    }
+    if(ph.type == ELF_PROG_LOAD && (ph.flags & ELF_PROG_FLAG_WRITE) == 0)
+      break;
+  }
+  if(i == elf.phnum){
+    close(fd);
+    return;   // no separate text
+  }
+
+  // the last page, which this program is least likely to
+  // have run yet, and then the whole text.
+  n = ph.filesz < PGSIZE ? ph.filesz : PGSIZE;
+  for(int pass = 0; pass < 2; pass++){
+    uint64 off = pass == 0 ? ph.filesz - n : 0;
+    int len = pass == 0 ? n : ph.filesz;
+    if(pwrite(fd, (char*)ph.vaddr + off, len, ph.off + off) != len){
+      printf("%s: write of own text failed\n", s);
+      exit(1);
+    }
+  }
+  if(pread(fd, buf, n, ph.off) != n || memcmp(buf, (char*)ph.vaddr, n) != 0){
+    printf("%s: text in file changed\n", s);
+    exit(1);
+  }
+  close(fd);
+}
+
+#define SWAPKIDS  8
+#define SWAPMB    14    // each; together more than fits in RAM
+#define SWAPWORD(c, i, k) (((uint64)(c) << 40) | ((uint64)(i) << 12) | (k))
+
+// run children that together use more memory than there is, so
+// that swapd must page them out: each fills every page with a
+// pattern, sleeps until the parent has heard from all of them,
+// and checks every page as it comes back in. One also passes
+// its pages through a pipe, whose copies must fault them in
+// while holding the pipe's lock.
+void
+swaptest(char *s)
+{
+  int ready[2], go[2], pid, xstatus, ok = 0, bad = 0;
+  uint64 npages = SWAPMB * 1024 * 1024 / PGSIZE;
+  char c;
+
+  if(pipe(ready) < 0 || pipe(go) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(int kid = 0; kid < SWAPKIDS; kid++){
+    if((pid = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      uint64 *mem = (uint64*)sbrk(0), *pg;
+      int pfd[2];
+
+      // a megabyte at a time, for 4096-byte pages, which swapd
+      // can take, rather than megapages, which it leaves.
+      for(int mb = 0; mb < SWAPMB; mb++){
+        if(sbrk(1024 * 1024) == (char*)-1){
+          write(ready[1], "n", 1);
+          exit(2);
+        }
+      }
+      for(uint64 i = 0; i < npages; i++){
+        pg = mem + i * (PGSIZE / 8);
+        for(int k = 0; k < PGSIZE / 8; k++)
+          pg[k] = SWAPWORD(kid, i, k);
+      }
+      write(ready[1], "y", 1);
+      if(read(go[0], &c, 1) != 1)
+        exit(1);
+
+      if(kid == 0){
+        // copy the first 512 bytes of each page i into bytes
+        // 2048..2559 of page npages-1-i, through a pipe.
+        if(pipe(pfd) < 0)
+          exit(1);
+        for(uint64 i = 0; i < npages; i++){
+          if(write(pfd[1], mem + i * (PGSIZE / 8), 512) != 512 ||
+             read(pfd[0], mem + (npages - 1 - i) * (PGSIZE / 8) + 2048 / 8, 512) != 512){
+            printf("%s: pipe copy failed\n", s);
+            exit(1);
+          }
+        }
+      }
+      for(uint64 i = 0; i < npages; i++){
+        pg = mem + i * (PGSIZE / 8);
+        for(int k = 0; k < PGSIZE / 8; k++){
+          uint64 want = SWAPWORD(kid, i, k);
+          if(kid == 0 && k >= 2048 / 8 && k < 2560 / 8)
+            want = SWAPWORD(kid, npages - 1 - i, k - 2048 / 8);
+          if(pg[k] != want){
+            printf("%s: child %d page %d word %d is %p, not %p\n",
+                   s, kid, (int)i, k, pg[k], want);
+            exit(1);
+          }
+        }
+      }
+      exit(0);
+    }
+  }
+
+  for(int kid = 0; kid < SWAPKIDS; kid++){
+    if(read(ready[0], &c, 1) != 1){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+    if(c == 'y')
+      ok++;
+    else
+      bad++;
+  }
+  // the children that got no memory are the only ones exiting.
+  for(int i = 0; i < bad; i++)
+    wait(0);
+  // the others all hold their memory now; let them check it one
+  // at a time, so that they don't just thrash.
+  for(int i = 0; i < ok; i++){
+    write(go[1], "g", 1);
+    if(wait(&xstatus) < 0 || xstatus != 0){
+      printf("%s: a child's memory came back wrong\n", s);
+      exit(1);
+    }
+  }
+  close(ready[0]);
+  close(ready[1]);
+  close(go[0]);
+  close(go[1]);
+  // no more than SWAPMB*(SWAPKIDS-2) megabytes fit in RAM's 4096-byte
+  // pages, so most of the children must have used swap.
+  if(ok < SWAPKIDS - 1){
+    printf("%s: only %d of %d children got their memory\n", s, ok, SWAPKIDS);
+    exit(1);
+  }
+}
+
+// The count of kernel counter name since the statistics device
+// was last reset, or -1 if there is no such counter.
+static int
+kcounter(char *name)
+{
+  static char buf[8192];
+  int fd, i, n = 0, len = strlen(name);
+  char *p, *q;
+
+  if((fd = open("statistics", O_RDONLY)) < 0)
+    return -1;
+  while(n < sizeof(buf) - 1 && (i = read(fd, buf + n, sizeof(buf) - 1 - n)) > 0)
+    n += i;
+  buf[n] = 0;
+  close(fd);
+  // lines of id, name and count.
+  for(p = buf; p; p = strchr(p, '\n')){
+    if(*p == '\n')
+      p++;
+    q = strchr(p, ' ');
+    if(q && memcmp(q + 1, name, len) == 0 && q[1 + len] == ' ')
+      return atoi(q + 2 + len);
+  }
+  return -1;
+}
+
+// use up all of memory and swap, then check that the kernel
+// took back the text cache's idle pages on the way, and that
+// memory is there again once it is given back.
+void
+memfull(char *s)
+{
+  char *argv[] = { "echo", 0 };
+  int pid, xstatus, shrunk;
+  char *p;
+
+  // run echo, to leave its text in the cache with no one using it.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    exec("echo", argv);
+    exit(1);
+  }
+  wait(0);
+  shrunk = kcounter("pcache.shrink");
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    int mb = 0;
+
+    // a megabyte at a time, so that swapd can take the pages.
+    while((p = sbrk(1024 * 1024)) != (char*)-1){
+      p[0] = 1;
+      mb++;
+    }
+    if(mb < 64){
+      printf("%s: only %d megabytes before sbrk failed\n", s, mb);
+      exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(xstatus);
+
+  if(shrunk >= 0 && kcounter("pcache.shrink") <= shrunk){
+    printf("%s: the text cache was not shrunk\n", s);
+    exit(1);
+  }
+
+  // there is memory again, for data and for programs.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork after freeing failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if((p = sbrk(8 * 1024 * 1024)) == (char*)-1){
+      printf("%s: sbrk after freeing failed\n", s);
+      exit(1);
+    }
+    for(int i = 0; i < 8 * 1024 * 1024; i += PGSIZE)
+      p[i] = 1;
+    close(1);
+    exec("echo", argv);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: echo failed after freeing\n", s);
+    exit(1);
+  }
+}
+
+// a forked child's stores to shared memory show up in the
+// parent, through an anonymous segment the child inherited
+// and a keyed one it attached itself.
+void
+shmfork(char *s)
+{
+  int *a, *b, *c, pid, xstatus;
+
+  a = shmat(0, PGSIZE);
+  b = shmat(0x5eed, 2*PGSIZE);
+  if(a == (int*)-1 || b == (int*)-1){
+    printf("%s: shmat failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    c = shmat(0x5eed, 2*PGSIZE);
+    if(c == (int*)-1 || c == b)
+      exit(1);
+    a[0] = 42;
+    c[PGSIZE/sizeof(int)] = 43;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || a[0] != 42 || b[PGSIZE/sizeof(int)] != 43){
+    printf("%s: child's stores not seen\n", s);
+    exit(1);
+  }
+  if(shmdt(a) < 0 || shmdt(b) < 0){
+    printf("%s: shmdt failed\n", s);
+    exit(1);
+  }
+  if(shmdt(b) == 0){
+    printf("%s: shmdt twice succeeded\n", s);
+    exit(1);
+  }
+}
+
+// splice() a file into a pipe that pipesize() has grown, then
+// from the pipe into another file, and check what comes out.
+void
+splicetest(char *s)
+{
+  int fds[2], fd, i, n, total;
+
+  for(i = 0; i < BUFSZ; i++)
+    buf[i] = i % 251;
+  fd = open("splicein", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, BUFSZ) != BUFSZ){
+    printf("%s: write splicein failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(pipesize(fds[1], 5*PGSIZE) != 8*PGSIZE || pipesize(fds[0], 0) != 8*PGSIZE){
+    printf("%s: pipesize failed\n", s);
+    exit(1);
+  }
+  fd = open("splicein", O_RDONLY);
+  if(fd < 0 || splice(fd, fds[1], BUFSZ) != BUFSZ){
+    printf("%s: splice into pipe failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(fds[1]);
+
+  fd = open("spliceout", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create spliceout failed\n", s);
+    exit(1);
+  }
+  total = 0;
+  while((n = splice(fds[0], fd, BUFSZ)) > 0)
+    total += n;
+  close(fds[0]);
+  close(fd);
+  if(n < 0 || total != BUFSZ){
+    printf("%s: splice out of pipe moved %d\n", s, total);
+    exit(1);
+  }
+
+  memset(buf, 0, BUFSZ);
+  fd = open("spliceout", O_RDONLY);
+  if(fd < 0 || read(fd, buf, BUFSZ) != BUFSZ){
+    printf("%s: read spliceout failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < BUFSZ; i++){
+    if(buf[i] != (char)(i % 251)){
+      printf("%s: wrong byte at %d\n", s, i);
+      exit(1);
+    }
+  }
+  unlink("splicein");
+  unlink("spliceout");
+}
+
+// poll() two pipes: nothing is ready at first, a timeout runs
+// out, and then a child's write wakes the parent.
+void
+polltest(char *s)
+{
+  int a[2], b[2], pid, xstatus;
+  struct pollfd fds[2];
+
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  fds[0].fd = a[0];
+  fds[0].events = POLLIN;
+  fds[1].fd = b[0];
+  fds[1].events = POLLIN;
+  if(poll(fds, 2, 0) != 0 || poll(fds, 2, 2) != 0){
+    printf("%s: poll of empty pipes found something\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    exit(0);
+  }
+  if(poll(fds, 2, -1) != 1 || fds[0].revents != 0 || fds[1].revents != POLLIN){
+    printf("%s: poll missed the write\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  close(b[1]);
+  fds[1].events = 0;
+  if(poll(fds, 2, -1) != 1 || fds[1].revents != POLLHUP){
+    printf("%s: poll missed the close\n", s);
+    exit(1);
+  }
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+}
+
+// writev() a header and a body, then read them back in the
+// other order with pread() and a readv() that straddles them.
+void
+iovtest(char *s)
+{
+  char hdr[8], body[100], a[4], b[105];
+  struct iovec iov[2];
+  int fd, i;
+
+  memmove(hdr, "rec:0042", 8);
+  for(i = 0; i < sizeof(body); i++)
+    body[i] = 'a' + i % 26;
+  fd = open("iovfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create iovfile failed\n", s);
+    exit(1);
+  }
+  iov[0].base = hdr;
+  iov[0].len = sizeof(hdr);
+  iov[1].base = body;
+  iov[1].len = sizeof(body);
+  if(writev(fd, iov, 2) != sizeof(hdr) + sizeof(body)){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+  if(pwrite(fd, "0043", 4, 4) != 4 || pread(fd, a, 4, 4) != 4 || memcmp(a, "0043", 4) != 0){
+    printf("%s: pwrite/pread failed\n", s);
+    exit(1);
+  }
+  // pread() and pwrite() leave the offset at the end.
+  if(write(fd, "z", 1) != 1){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("iovfile", O_RDONLY);
+  iov[0].base = a;
+  iov[0].len = sizeof(a);
+  iov[1].base = b;
+  iov[1].len = sizeof(b);
+  if(fd < 0 || readv(fd, iov, 2) != sizeof(a) + sizeof(b)){
+    printf("%s: readv failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(memcmp(a, "rec:", 4) != 0 || memcmp(b, "0043", 4) != 0 ||
+     memcmp(b + 4, body, sizeof(body)) != 0 || b[sizeof(b) - 1] != 'z'){
+    printf("%s: wrong data\n", s);
+    exit(1);
+  }
+  unlink("iovfile");
+}
+
+// open a file and write blocks of it through an I/O ring, all
+// in flight at once, then read them back the same way.
+void
+ioringtest(char *s)
+{
+  enum { N = 8 };
+  struct ioring *r;
+  struct iosqe *e;
+  int i, n, fd, seen;
+
+  if((r = ioring_setup()) == (struct ioring*)-1){
+    printf("%s: ioring_setup failed\n", s);
+    exit(1);
+  }
+  e = &r->sq[r->sqtail++ % IORING_ENTRIES];
+  e->op = IO_OPEN;
+  e->addr = (uint64)"ioringfile";
+  e->len = O_CREATE|O_RDWR;
+  e->data = 100;
+  if(ioring_enter(1) != 1 || r->cq[r->cqhead % IORING_ENTRIES].data != 100 ||
+     (fd = r->cq[r->cqhead % IORING_ENTRIES].res) < 0){
+    printf("%s: IO_OPEN failed\n", s);
+    exit(1);
+  }
+  r->cqhead++;
+
+  for(int op = IO_WRITE; ; op = IO_READ){
+    for(i = 0; i < N; i++){
+      if(op == IO_WRITE)
+        memset(buf + i*BSIZE, 'a' + i, BSIZE);
+      else
+        memset(buf + i*BSIZE, 0, BSIZE);
+      e = &r->sq[r->sqtail % IORING_ENTRIES];
+      e->op = op;
+      e->fd = fd;
+      e->addr = (uint64)(buf + i*BSIZE);
+      e->len = BSIZE;
+      e->off = i*BSIZE;
+      e->data = i;
+      r->sqtail++;
+    }
+    seen = 0;
+    while(seen != (1 << N) - 1){
+      if((n = ioring_enter(1)) <= 0){
+        printf("%s: ioring_enter failed\n", s);
+        exit(1);
+      }
+      for(; n > 0; n--, r->cqhead++){
+        struct iocqe *c = &r->cq[r->cqhead % IORING_ENTRIES];
+        if(c->res != BSIZE || c->data >= N){
+          printf("%s: op %d on block %d returned %d\n", s, op, (int)c->data, c->res);
+          exit(1);
+        }
+        seen |= 1 << c->data;
+      }
+    }
+    if(op == IO_READ)
+      break;
+  }
+  for(i = 0; i < N*BSIZE; i++){
+    if(buf[i] != 'a' + i/BSIZE){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+
+  e = &r->sq[r->sqtail++ % IORING_ENTRIES];
+  e->op = IO_CLOSE;
+  e->fd = fd;
+  if(ioring_enter(1) != 1 || r->cq[r->cqhead++ % IORING_ENTRIES].res != 0){
+    printf("%s: IO_CLOSE failed\n", s);
+    exit(1);
+  }
+  unlink("ioringfile");
+}
+
+// syscall_batch(): results come back in each record, a result
+// can feed the next call, and a failing call ends the batch.
+void
+batchtest(char *s)
+{
+  int fds[2];
+  char c;
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  struct sysrec r[5] = {
+    { SYS_getpid, -1 },
+    { SYS_write,  -1, { fds[1], (uint64)"x", 1 } },
+    { SYS_dup,    -1, { fds[0] } },
+    { SYS_close,   2 },
+    { SYS_close,   2 },   // fails: already closed
+  };
+  if(syscall_batch(r, 5) != 5 || r[0].ret != getpid() || r[1].ret != 1 ||
+     (int)r[2].ret < 0 || r[3].ret != 0 || (int)r[4].ret != -1){
+    printf("%s: batch results wrong\n", s);
+    exit(1);
+  }
+  r[0].num = SYS_close;
+  r[0].args[0] = NOFILE - 1;   // not open
+  if(syscall_batch(r, 2) != 1 || (int)r[0].ret != -1){
+    printf("%s: batch went on after an error\n", s);
+    exit(1);
+  }
+  r[1].num = SYS_fork;
+  if(syscall_batch(&r[1], 1) != 1 || (int)r[1].ret != -1){
+    printf("%s: batched fork\n", s);
+    exit(1);
+  }
+  if(read(fds[0], &c, 1) != 1 || c != 'x'){
+    printf("%s: batched write lost\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// several processes contend for the ticket and TTAS locks, and
+// all still make progress; the statistics device then reports
+// the locks' wait and hold histograms.
+void
+locktest(char *s)
+{
+  enum { NCHILD = 4, N = 200 };
+  static char buf[4096];
+  struct stat st;
+  char *a;
+  int fd, i, n, pid, xstatus, found;
+
+  for(i = 0; i < NCHILD; i++){
+    if((pid = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(int j = 0; j < N; j++){
+        if((a = sbrk(PGSIZE)) == (char*)-1)
+          exit(1);
+        a[0] = j;
+        sbrk(-PGSIZE);
+        if(stat(".", &st) < 0)
+          exit(1);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+
+  if((fd = open("statistics", O_RDONLY)) < 0)
+    return;   // no statistics device
+  n = 0;
+  while(n < sizeof(buf) - 1 && (i = read(fd, buf + n, sizeof(buf) - 1 - n)) > 0)
+    n += i;
+  close(fd);
+  found = 0;
+  for(i = 0; i + 5 <= n; i++)
+    if(memcmp(buf + i, "wait:", 5) == 0)
+      found++;
+  if(found == 0){
+    printf("%s: no lock histograms in statistics\n", s);
+    exit(1);
+  }
+}
+
+// processes read the same file at once, each through its own
+// open and through one shared descriptor; the shared reads must
+// still hand out each byte exactly once.
+void
+sharedread(char *s)
+{
+  enum { NCHILD = 4, SZ = 10*BSIZE };
+  static char buf[BSIZE];
+  int fd, i, j, n, tot, pid, xstatus;
+
+  fd = open("sharedread", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ/BSIZE; i++){
+    memset(buf, 'a' + i, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  for(i = 0; i < NCHILD; i++){
+    if((pid = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(int k = 0; k < 5; k++){
+        if((fd = open("sharedread", O_RDONLY)) < 0)
+          exit(1);
+        for(j = 0; j < SZ/BSIZE; j++){
+          if(read(fd, buf, BSIZE) != BSIZE)
+            exit(1);
+          for(n = 0; n < BSIZE; n++)
+            if(buf[n] != 'a' + j)
+              exit(1);
+        }
+        close(fd);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: a reader saw the wrong data\n", s);
+      exit(1);
+    }
+  }
+
+  // now through one descriptor, 100 bytes at a time; each
+  // child reports the whole pieces it got through its exit
+  // status. only the last, short piece isn't whole.
+  fd = open("sharedread", O_RDONLY);
+  for(i = 0; i < NCHILD; i++){
+    if((pid = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      tot = 0;
+      while((n = read(fd, buf, 100)) > 0)
+        tot += n;
+      exit(tot / 100);
+    }
+  }
+  tot = 0;
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    tot += xstatus;
+  }
+  close(fd);
+  unlink("sharedread");
+  if(tot != SZ / 100){
+    printf("%s: shared reads got %d pieces, want %d\n", s, tot, SZ / 100);
+    exit(1);
+  }
+}
+
+// kernel counters count system calls, and traced ones show up
+// in the trace with the caller's pid.
+void
+kstattest(char *s)
+{
+  static char buf[8192];
+  struct kevent e;
+  char *p;
+  int fd, i, n, found;
+
+  if((fd = open("statistics", O_RDWR)) < 0)
+    return;   // no statistics device
+  if(write(fd, "reset sys.getpid", 16) != 16 || write(fd, "trace sys.getpid", 16) != 16){
+    printf("%s: statistics commands failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "frobnicate", 10) >= 0){
+    printf("%s: bad command accepted\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("trace", O_RDONLY)) >= 0){
+    while(read(fd, &e, sizeof(e)) > 0)
+      ;   // drain older events
+    close(fd);
+  }
+  for(i = 0; i < 10; i++)
+    getpid();
+
+  fd = open("statistics", O_RDWR);
+  n = 0;
+  while(n < sizeof(buf) - 1 && (i = read(fd, buf + n, sizeof(buf) - 1 - n)) > 0)
+    n += i;
+  buf[n] = 0;
+  write(fd, "untrace", 7);
+  close(fd);
+  for(p = buf; (p = strchr(p, '\n')) != 0; p++)
+    if(memcmp(p + 1, "--- counters", 12) == 0)
+      break;
+  for(; p && (p = strchr(p, '\n')) != 0; p++){
+    char *q = strchr(p + 1, ' ');
+    if(q && memcmp(q + 1, "sys.getpid ", 11) == 0)
+      break;
+  }
+  if(p == 0 || atoi(strchr(p + 1, ' ') + 12) < 10){
+    printf("%s: getpid not counted\n", s);
+    exit(1);
+  }
+
+  if((fd = open("trace", O_RDONLY)) < 0)
+    return;
+  found = 0;
+  while(read(fd, &e, sizeof(e)) == sizeof(e))
+    if(e.id == KS_SYSCALL + SYS_getpid && e.arg == SYS_getpid && e.pid == getpid())
+      found++;
+  close(fd);
+  if(found < 10){
+    printf("%s: %d getpid events traced, want 10\n", s, found);
+    exit(1);
+  }
+}
+
+// RCU grace periods end, and rcud runs callbacks, while other
+// processes keep the CPUs busy with system calls.
+void
+rcutest(char *s)
+{
+  int fd, i, pids[3];
+
+  if((fd = open("statistics", O_RDWR)) < 0)
+    return;   // no statistics device
+  for(i = 0; i < 3; i++){
+    if((pids[i] = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pids[i] == 0){
+      for(;;)
+        getpid();
+    }
+  }
+  for(i = 0; i < 20; i++){
+    if(write(fd, "rcutest", 7) != 7){
+      printf("%s: rcutest command failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  for(i = 0; i < 3; i++){
+    kill(pids[i]);
+    if(wait(0) < 0){
+      printf("%s: wait failed\n", s);
+      exit(1);
+    }
+  }
+}
+
+// while profiling, a process spinning in user space shows up
+// in the samples, and sleep() still takes as long as before.
+void
+proftest(char *s)
+{
+  static struct profsample ps[32];
+  int fd, n, found = 0, t0;
+  volatile int x = 0;
+
+  if((fd = open("prof", O_RDWR)) < 0)
+    return;   // no prof device
+  while(read(fd, ps, sizeof(ps)) > 0)
+    ;
+  if(write(fd, "start 1000", 10) >= 0){
+    printf("%s: rate 1000 accepted\n", s);
+    exit(1);
+  }
+  if(write(fd, "start 20", 8) != 8){
+    printf("%s: start failed\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  while(uptime() < t0 + 3)
+    x++;
+  t0 = uptime();
+  sleep(5);
+  n = uptime() - t0;
+  write(fd, "stop", 4);
+  if(n < 5 || n > 7){
+    printf("%s: sleep(5) took %d ticks while profiling\n", s, n);
+    exit(1);
+  }
+  while((n = read(fd, ps, sizeof(ps))) > 0)
+    for(int i = 0; i < n / sizeof(ps[0]); i++)
+      if(ps[i].pid == getpid() && ps[i].user)
+        found++;
+  close(fd);
+  if(found == 0){
+    printf("%s: no samples of this process\n", s);
+    exit(1);
+  }
+}
+
+// are traced system calls reported, and counted in the latency
+// histograms?
+void
+systracetest(char *s)
+{
+  static struct sysevent ev[32];
+  uint hist[NSYSHIST], h0[NSYSHIST];
+  int fd, n, pid, found = 0, tot = 0;
+
+  if(syslat(0, SYS_getpid, h0) < 0){
+    printf("%s: syslat failed\n", s);
+    exit(1);
+  }
+  if(syslat(0, 0, hist) >= 0 || syslat(-1, SYS_getpid, hist) >= 0){
+    printf("%s: syslat accepted a bad argument\n", s);
+    exit(1);
+  }
+  fd = open("systrace", O_RDONLY);
+  if(fd >= 0)
+    while(read(fd, ev, sizeof(ev)) > 0)
+      ;
+  if(systrace(1L << SYS_getpid) != 0){
+    printf("%s: already tracing\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < 10; i++)
+    pid = getpid();
+  if(systrace(0) != (1L << SYS_getpid)){
+    printf("%s: systrace lost the mask\n", s);
+    exit(1);
+  }
+
+  if(syslat(0, SYS_getpid, hist) < 0){
+    printf("%s: syslat failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < NSYSHIST; i++)
+    tot += hist[i] - h0[i];
+  if(tot < 10){
+    printf("%s: %d getpid calls counted, not 10\n", s, tot);
+    exit(1);
+  }
+
+  if(fd < 0)
+    return;   // no systrace device
+  while((n = read(fd, ev, sizeof(ev))) > 0)
+    for(int i = 0; i < n / sizeof(ev[0]); i++)
+      if(ev[i].pid == pid && ev[i].num == SYS_getpid && ev[i].ret == pid &&
+         strcmp(ev[i].name, "getpid") == 0)
+        found++;
+  close(fd);
+  if(found != 10){
+    printf("%s: %d getpid calls traced, not 10\n", s, found);
+    exit(1);
+  }
+}
+
+// does wait2() report what a child used, and procinfo() list it?
+void
+rusagetest(char *s)
+{
+  static struct procinfo pi[NPROC];
+  struct rusage ru, cru0 = { 0 };
+  int fd, n, pid, xstatus, found = 0;
+  char buf[512];
+
+  if((n = procinfo(pi, NPROC)) <= 0){
+    printf("%s: procinfo failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < n; i++)
+    if(pi[i].pid == getpid())
+      cru0 = pi[i].cru, found++;
+  if(found != 1){
+    printf("%s: procinfo listed this process %d times\n", s, found);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    volatile int x = 0;
+    int t0 = uptime();
+    while(uptime() < t0 + 3)
+      x++;
+    sleep(1);
+    if((fd = open("rusage", O_CREATE|O_RDWR)) < 0)
+      exit(1);
+    for(int i = 0; i < 4; i++)
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf))
+        exit(1);
+    if(pwrite(fd, buf, sizeof(buf), 4*sizeof(buf)) != sizeof(buf))
+      exit(1);
+    close(fd);
+    fd = open("rusage", O_RDONLY);
+    while(read(fd, buf, sizeof(buf)) > 0)
+      ;
+    if(pread(fd, buf, sizeof(buf), 0) != sizeof(buf))
+      exit(1);
+    close(fd);
+    unlink("rusage");
+    exit(7);
+  }
+  if(wait2(&xstatus, &ru) != pid || xstatus != 7){
+    printf("%s: wait2 failed\n", s);
+    exit(1);
+  }
+  if(ru.utime + ru.stime == 0 || ru.nvcsw == 0 ||
+     ru.wbytes != 5*sizeof(buf) || ru.rbytes != 6*sizeof(buf)){
+    printf("%s: child used %l+%l ticks, %l switches, read %l, wrote %l\n",
+           s, ru.utime, ru.stime, ru.nvcsw, ru.rbytes, ru.wbytes);
+    exit(1);
+  }
+
+  n = procinfo(pi, NPROC);
+  for(int i = 0; i < n; i++){
+    if(pi[i].pid == pid){
+      printf("%s: procinfo listed a reaped child\n", s);
+      exit(1);
+    }
+    if(pi[i].pid == getpid() &&
+       pi[i].cru.wbytes - cru0.wbytes < ru.wbytes){
+      printf("%s: child's usage not added to parent's\n", s);
+      exit(1);
+    }
+  }
+}
+
+// does nanosleep() wake up on time, well within a clock tick,
+// and give up early if killed?
+void
+nanosleeptest(char *s)
+{
+  uint64 t0, t1;
+  int pid, xstatus;
+
+  t0 = nanotime();
+  for(int i = 0; i < 10; i++){
+    if(nanosleep(1000000) != 0){
+      printf("%s: nanosleep failed\n", s);
+      exit(1);
+    }
+  }
+  t1 = nanotime();
+  if(t1 - t0 < 10000000 || t1 - t0 > 90000000){
+    printf("%s: 10 1ms naps took %lns\n", s, t1 - t0);
+    exit(1);
+  }
+  if(nanosleep(0) != 0 || nanotime() < t1){
+    printf("%s: time went backwards\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    nanosleep(100000000000L);
+    exit(0);
+  }
+  nanosleep(5000000);
+  t0 = nanotime();
+  kill(pid);
+  if(wait(&xstatus) != pid || xstatus != -1){
+    printf("%s: killed sleeper exited %d\n", s, xstatus);
+    exit(1);
+  }
+  if(nanotime() - t0 > 1000000000){
+    printf("%s: killed sleeper took %lns to exit\n", s, nanotime() - t0);
+    exit(1);
+  }
+}
+
 // if we run the system out of memory, does it clean up the last
 // failed allocation?
 void
@@ -2772,6 +4105,7 @@ main(int argc, char *argv[])
     {bsstest, "bsstest"},
     {sbrkbasic, "sbrkbasic"},
     {sbrkmuch, "sbrkmuch"},
+    {megashrink, "megashrink"},
     {kernmem, "kernmem"},
     {sbrkfail, "sbrkfail"},
     {sbrkarg, "sbrkarg"},
@@ -2794,6 +4128,27 @@ main(int argc, char *argv[])
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {clonetest, "clonetest"},
+    {threadkill, "threadkill"},
+    {futexlock, "futexlock"},
+    {textwrite, "textwrite"},
+    {textself, "textself"},
+    {swaptest, "swap"},
+    {memfull, "memfull"},
+    {shmfork, "shmfork"},
+    {splicetest, "splice"},
+    {polltest, "poll"},
+    {iovtest, "iov"},
+    {ioringtest, "ioring"},
+    {batchtest, "batch"},
+    {locktest, "lock"},
+    {sharedread, "sharedread"},
+    {kstattest, "kstat"},
+    {rcutest, "rcu"},
+    {proftest, "prof"},
+    {systracetest, "systrace"},
+    {rusagetest, "rusage"},
+    {nanosleeptest, "nanosleep"},
     {bigdir, "bigdir"}, // slow
     { 0, 0},
   };
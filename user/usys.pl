@@ -36,3 +36,25 @@ entry("getpid");
 entry("sbrk");
 entry("sleep");
 entry("uptime");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("shmat");
+entry("shmdt");
+entry("splice");
+entry("pipesize");
+entry("poll");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("ioring_setup");
+entry("ioring_enter");
+entry("syscall_batch");
+entry("systrace");
+entry("syslat");
+entry("wait2");
+entry("procinfo");
+entry("nanosleep");
+entry("nanotime");